@@ -44,6 +44,13 @@ static const TabTitleTransformRule tabhdr_title_transforms[] = {
 	{ NULL, NULL },
 };
 
+/* IPC */
+static const size_t ipc_outbound_limit = 256 * 1024; /* bytes queued per client before ipc_slow_policy applies */
+static const enum IPCSlowPolicy ipc_slow_policy = IPC_SLOW_DROP_OLDEST; /* or IPC_SLOW_DISCONNECT */
+static const size_t ipc_max_request = 64 * 1024; /* longest request line accepted, in bytes */
+static const size_t ipc_history = 32; /* published states a delta subscriber can resume from with since_seq */
+static const size_t ipc_fanout_batch = 32; /* subscribers sent a publish per loop iteration, 0 for all at once */
+
 /* cursor */
 static const int cursor_size = 24;
 
@@ -61,6 +68,15 @@ static const Rule rules[] = {
 	{ "firefox_EXAMPLE",  NULL,       2,         -1 },
 };
 
+/* Layer surfaces (bars, docks) matched by namespace with autohide set stay hidden until the pointer
+ * touches the monitor edge they are anchored to, and overlay windows instead of reserving space.
+ * NOTE: ALWAYS keep a rule declared even if you don't use rules (e.g leave at least one example) */
+static const LayerRule layerrules[] = {
+	/* namespace          autohide */
+	/* examples: */
+	{ "waybar_EXAMPLE",   1 },
+};
+
 /* layout(s) */
 static const Layout layouts[] = {
 	/* symbol     arrange function */
@@ -1,7 +1,8 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE /* memfd_create() and file sealing */
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -9,7 +10,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -20,177 +24,587 @@
 
 #include "vwl.h"
 #include "ipc.h"
+#include "json.h"
 #include "spawnrules.h"
 #include "util.h"
+#include "vwl-ipc-unstable-v1-protocol.h"
 
-#define IPC_CLIENT_BUFFER 4096
+#define IPC_CLIENT_BUFFER 4096 /* initial receive buffer, grown up to max_request */
+#define IPC_FLUSH_IOV 64
+#define IPC_GEOM_IDS 64 /* client ids one watch_geometry can name */
+#define IPC_CLIENT_WAITS 16 /* unanswered wait requests per connection */
+
+enum { IPC_SUB_NONE, IPC_SUB_SNAPSHOT, IPC_SUB_DELTA }; /* subscription modes */
+
+/* state sections a subscriber can ask for, see ipc_topic_names */
+enum {
+	IPC_TOPIC_POINTER = 1 << 0,
+	IPC_TOPIC_FOCUS = 1 << 1,
+	IPC_TOPIC_OUTPUTS = 1 << 2, /* outputs and virtual outputs */
+	IPC_TOPIC_WORKSPACES = 1 << 3,
+	IPC_TOPIC_WINDOWS = 1 << 4, /* active window per output */
+	IPC_TOPIC_ALL = (1 << 5) - 1,
+};
+
+static const char *const ipc_topic_names[] = {"pointer", "focus", "outputs", "workspaces", "windows"};
+
+/* what a wait request waits for, see ipc_wait_names */
+enum { IPC_WAIT_APP_MAPPED, IPC_WAIT_WORKSPACE_VISIBLE, IPC_WAIT_OUTPUT_PRESENT };
+
+static const char *const ipc_wait_names[] = {"app_mapped", "workspace_visible", "output_present"};
+
+/* top-level state keys a get_state or subscribe can be narrowed to, see ipc_field_names */
+enum {
+	IPC_FIELD_FOCUSED_OUTPUT = 1 << 0,
+	IPC_FIELD_FOCUSED_VOUT = 1 << 1,
+	IPC_FIELD_FOCUSED_WORKSPACE = 1 << 2,
+	IPC_FIELD_POINTER = 1 << 3,
+	IPC_FIELD_OUTPUTS = 1 << 4,
+	IPC_FIELD_VOUTS = 1 << 5,
+	IPC_FIELD_WORKSPACES = 1 << 6,
+	IPC_FIELD_ALL = (1 << 7) - 1,
+	IPC_VIEW_POPULATED = 1 << 7, /* leave out workspaces without clients that are not shown */
+};
+
+static const char *const ipc_field_names[] = {"focused_output", "focused_virtual_output", "focused_workspace",
+		"pointer", "outputs", "virtual_outputs", "workspaces"};
+/* topics a field is built from; a subscriber is only sent what these cover */
+static const unsigned int ipc_field_topics[] = {IPC_TOPIC_FOCUS, IPC_TOPIC_FOCUS, IPC_TOPIC_FOCUS, IPC_TOPIC_POINTER,
+		IPC_TOPIC_OUTPUTS | IPC_TOPIC_WINDOWS, IPC_TOPIC_OUTPUTS, IPC_TOPIC_WORKSPACES};
+
+/* One newline-terminated line waiting in a client's outbound queue. */
+typedef struct IPCMessage {
+	struct wl_list link;
+	bool event; /* state event, may be dropped when the client falls behind */
+	int fd; /* passed along with the first byte, -1 if none */
+	size_t len;
+	char data[];
+} IPCMessage;
 
 typedef struct IPCClient {
 	struct wl_list link;
 	int fd;
 	int subscribed;
+	unsigned int topics; /* IPC_TOPIC_* the subscription covers */
+	unsigned int view; /* IPC_FIELD_* and IPC_VIEW_* of its state events */
+	char *buffer; /* received bytes, [start, used) not handled yet */
+	size_t size;
+	size_t start;
 	size_t used;
-	char buffer[IPC_CLIENT_BUFFER];
+	size_t scanned; /* bytes before this are known to hold no unhandled newline */
+	bool overlong; /* discarding the rest of a request that was too large */
+	bool eof; /* peer is done sending; close once its replies are out unless subscribed, watching or waiting */
+	bool greeted; /* past its first request, too late for hello */
+	bool binary; /* negotiated binary framing, see VwlIpcFrame */
 	struct wl_event_source *source;
+	struct wl_list outq; /* IPCMessage.link, oldest first */
+	size_t queued; /* bytes in outq */
+	size_t head_sent; /* bytes of the oldest message already sent */
+	bool resync; /* delta events were dropped, a full state must follow */
+	struct wl_list fanout_link; /* IPCFanout.clients while it is owed the last publish */
+	IPCModel *fanout_base; /* state it had reached when it went on that list */
+	int max_hz; /* most state events per second the subscription gets, 0 for no limit */
+	struct timespec rate_sent; /* when the last state event or the subscribe reply went out */
+	IPCModel *rate_base; /* state the client has reached while publishes are held back */
+	struct wl_event_source *rate_timer; /* sends the held back publishes as one */
+	bool geom_watch; /* gets geometry events, see ipc_geometry_flush() */
+	bool geom_resync; /* geometry events were dropped, resend every watched window */
+	size_t ngeom_ids; /* 0 to watch every window */
+	unsigned int geom_ids[IPC_GEOM_IDS];
+	size_t nwaits; /* its IPCWaits */
 } IPCClient;
 
+/* A wait request not answered yet, see ipc_wait_next(). */
+typedef struct IPCWait {
+	struct wl_list link; /* ipc_server.waits */
+	IPCClient *client;
+	int id; /* of the request, for the reply */
+	int condition; /* IPC_WAIT_* */
+	char app_id[128];
+	unsigned int workspace_id;
+	unsigned int vout_id; /* 0 for any virtual output */
+	char output[128];
+	char vout_name[WORKSPACE_NAME_LEN]; /* on output, "" for any */
+	struct wl_event_source *timer; /* answers with a timeout error, NULL without timeout_ms */
+} IPCWait;
+
+/* Fields of one request; each got_* is 1 if present, 0 if missing and -1 if malformed. */
+typedef struct IPCRequest {
+	int id, got_id;
+	char type[64];
+	int got_type;
+	char mode[16];
+	int got_mode;
+	char protocol[16];
+	int got_protocol;
+	unsigned int topics;
+	int got_topics;
+	unsigned int fields;
+	int got_fields;
+	bool only_populated;
+	int got_only_populated;
+	unsigned long since_seq;
+	int got_since_seq;
+	int max_hz, got_max_hz;
+	unsigned int clients[IPC_GEOM_IDS];
+	size_t nclients;
+	int got_clients;
+	int workspace_id, got_workspace_id;
+	unsigned int client_id;
+	int got_client_id;
+	int vout_id, got_vout_id;
+	char output[128];
+	int got_output;
+	char vout_name[WORKSPACE_NAME_LEN];
+	int got_vout_name;
+	char command[2048];
+	int got_command;
+	char condition[32];
+	int got_condition;
+	char app_id[128];
+	int got_app_id;
+	int timeout_ms, got_timeout_ms;
+	const char *commands, *commands_end; /* batch array, validated but not parsed */
+	int got_commands;
+} IPCRequest;
+
+typedef struct IPCOutputModel {
+	char *name;
+	bool focused;
+	struct wlr_box geometry;
+	struct wlr_box workarea;
+	int active_vout; /* -1 when unset, like every id below */
+	bool has_window;
+	unsigned int window_id; /* Client.id */
+	char *title;
+	char *appid;
+	bool fullscreen;
+	bool tabbed;
+} IPCOutputModel;
+
+typedef struct IPCVoutModel {
+	unsigned int id;
+	char name[WORKSPACE_NAME_LEN];
+	int output; /* index into IPCModel.outputs */
+	bool focused;
+	int workspace;
+	char workspace_name[WORKSPACE_NAME_LEN];
+	char layout[16];
+	unsigned int clients;
+	bool urgent;
+	struct wlr_box geometry;
+} IPCVoutModel;
+
+typedef struct IPCWorkspaceModel {
+	bool listed;
+	char name[WORKSPACE_NAME_LEN];
+	bool assigned;
+	bool visible;
+	bool focused;
+	unsigned int clients;
+	bool urgent;
+	int output; /* index into IPCModel.outputs */
+	int vout;
+	char vout_name[WORKSPACE_NAME_LEN];
+} IPCWorkspaceModel;
+
+/* A tab of a tabbed virtual output, as zvwl_ipc_output_v1.tab_window reports it. */
+typedef struct IPCWlTab {
+	char *title;
+	char *appid;
+} IPCWlTab;
+
+/* What a zvwl_ipc_output_v1 shows of its output, see ipc_wl_capture(). */
+typedef struct IPCWlState {
+	bool active;
+	int workspace; /* on the focused virtual output, -1 for none */
+	char workspace_name[WORKSPACE_NAME_LEN];
+	char *title, *appid; /* of the focused window, "" for none */
+	bool fullscreen, floating;
+	bool urgent;
+	unsigned int clients;
+	char layout[16];
+	bool tabbed;
+	size_t ntabs, tab_index;
+	IPCWlTab *tabs;
+	size_t nvouts;
+	IPCVoutModel *vouts; /* focused is set for the output's focused one */
+} IPCWlState;
+
+typedef struct IPCWlOutput {
+	struct wl_list link; /* ipc_server.wl_outputs */
+	struct wl_resource *resource;
+	Monitor *mon; /* NULL once the output is gone */
+	bool sent; /* has had its first update */
+	IPCWlState state; /* as last sent */
+} IPCWlOutput;
+
+/* Snapshot narrowed by fields or only_populated, cached on the model like the per-topic ones. */
+typedef struct IPCModelView {
+	unsigned int topics;
+	unsigned int view;
+	char *snapshot;
+	char *event;
+} IPCModelView;
+
+/*
+ * Captured copy of the state published to IPC clients. The state itself is never
+ * modified once built; its serialized forms are filled in on first use.
+ */
+typedef struct IPCModel {
+	int refs;
+	unsigned long generation; /* ipc_server.generation it was captured at */
+	char *snapshots[IPC_TOPIC_ALL + 1]; /* build_snapshot() per topic set */
+	char *events[IPC_TOPIC_ALL + 1]; /* the same, wrapped in a state event */
+	char *frames[IPC_TOPIC_ALL + 1]; /* binary state frame per topic set */
+	size_t frame_lens[IPC_TOPIC_ALL + 1];
+	IPCModelView *views; /* narrowed snapshots, see model_view() */
+	size_t nviews;
+	int focused_output; /* index into outputs */
+	int focused_vout;
+	int focused_workspace;
+	int pointer_output; /* index into outputs */
+	bool reveal_hover;
+	int reveal_edge;
+	size_t noutputs;
+	IPCOutputModel *outputs;
+	size_t nvouts;
+	IPCVoutModel *vouts;
+	IPCWorkspaceModel workspaces[WORKSPACE_COUNT];
+} IPCModel;
+
+/*
+ * A publish being sent to the subscribers, which may take several loop
+ * iterations, see ipc_fanout_run(). Its deltas and frames are built once per
+ * topic set on first use for the subscribers whose state is the base; those
+ * still owed an earlier publish get theirs from their own fanout_base.
+ */
+typedef struct IPCFanout {
+	IPCModel *base; /* last publish before this one; the target is ipc_server.last */
+	struct wl_list clients; /* IPCClient.fanout_link, subscribers still owed it */
+	const char *deltas[IPC_TOPIC_ALL + 1];
+	const char *frames[IPC_TOPIC_ALL + 1];
+	size_t frame_lens[IPC_TOPIC_ALL + 1];
+	bool built[IPC_TOPIC_ALL + 1];
+	bool frames_built[IPC_TOPIC_ALL + 1];
+	bool checked[IPC_TOPIC_ALL + 1];
+	bool resync[IPC_TOPIC_ALL + 1];
+} IPCFanout;
+
 static struct {
 	int listen_fd;
 	char path[PATH_MAX];
 	struct wl_event_source *listen_source;
 	struct wl_list clients;
+	unsigned long generation; /* bumped by ipc_mark_dirty() */
+	IPCModel *current; /* model of the current generation, if captured */
+	IPCModel *last; /* last published model, baseline for deltas */
+	IPCModel **history; /* ring of recently published models, see ipc_history_add() */
+	size_t history_head, history_len;
+	unsigned long delta_seq; /* seq stamped on the deltas being built */
+	JsonBuf scratch; /* replies and serialized state are built here */
+	JsonBuf results; /* per-command results of a batch */
+	JsonBuf deltas[IPC_TOPIC_ALL + 1]; /* per topic set, reused across publishes */
+	JsonBuf frames[IPC_TOPIC_ALL + 1]; /* binary event frames, the same way */
+	JsonBuf records, strings; /* binary frame being built */
+	JsonBuf metrics; /* text of the last get_metrics reply */
+	unsigned int nrecords;
+	struct wl_event_source *publish_source; /* pending idle publish, if any */
+	IPCFanout fanout;
+	int fanout_fd; /* eventfd that resumes a fan-out on the next loop iteration */
+	struct wl_event_source *fanout_source;
+	unsigned long updates; /* updateipc() calls */
+	unsigned long publishes; /* idle publishes they collapsed into */
+	unsigned long sent_bytes[2]; /* accepted by ipc_send(), indexed by whether it was an event */
+	unsigned long dropped_events; /* state events discarded for slow clients */
+	unsigned long dropped_clients; /* clients disconnected for falling behind */
+	struct wl_list geom_dirty; /* Client.ipc_geom_link, changed since the last frame */
+	size_t geom_watchers;
+	bool geom_resync; /* some watcher has geom_resync set */
+	unsigned int *geom_unmapped; /* ids unmapped since the last frame */
+	size_t ngeom_unmapped, geom_unmapped_cap;
+	int shm_fd; /* state page, created by the first get_state_fd */
+	struct VwlIpcShmState *shm;
+	unsigned long shm_generation; /* generation the page holds */
+	struct wl_list waits; /* IPCWait.link, oldest first */
+	unsigned long wait_generation; /* generation the waits were last checked against */
+	struct wl_global *wl_global; /* zvwl_ipc_manager_v1 */
+	struct wl_list wl_outputs; /* IPCWlOutput.link */
+	unsigned long wl_generation; /* generation the output objects were last updated to */
 } ipc_server = {
 		.listen_fd = -1,
+		.shm_fd = -1,
+		.fanout_fd = -1,
 };
 
 static void ipc_client_destroy(IPCClient *client);
 static int ipc_listen_ready(int fd, uint32_t mask, void *data);
 static int ipc_client_ready(int fd, uint32_t mask, void *data);
-static int ipc_send_line(IPCClient *client, const char *line);
-static int handle_request(IPCClient *client, const char *line);
+static int ipc_send_line(IPCClient *client, const char *line, bool event);
+static int handle_request(IPCClient *client, const char *line, size_t len);
 static int handle_client_buffer(IPCClient *client);
+static void ipc_publish(void);
+static void ipc_flush(void);
+static int ipc_fanout_client(IPCClient *client);
+static int ipc_fanout_ready(int fd, uint32_t mask, void *data);
+static void ipc_wl_update(void);
+static void ipc_wl_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id);
 void tabbed(Monitor *m);
 
 static const char *
-skip_ws(const char *p)
+request_int(const char *p, const char *end, int *value, int *got)
 {
-	while (p && *p && isspace((unsigned char)*p)) p++;
-	return p;
+	long parsed;
+	const char *next = json_read_int(p, end, &parsed);
+
+	if (!next || parsed < INT_MIN || parsed > INT_MAX) {
+		*got = -1;
+		return json_skip_value(p, end);
+	}
+	*value = (int)parsed;
+	*got = 1;
+	return next;
 }
 
 static const char *
-find_key(const char *json, const char *key)
+request_string(const char *p, const char *end, char *out, size_t out_sz, int *got)
 {
-	char needle[64];
-	const char *p;
+	size_t len;
+	const char *next = json_read_string(p, end, out, out_sz, &len);
 
-	snprintf(needle, sizeof(needle), "\"%s\"", key);
-	p = strstr(json, needle);
-	if (!p)
-		return NULL;
-	p += strlen(needle);
-	p = skip_ws(p);
-	if (!p || *p != ':')
-		return NULL;
-	return skip_ws(p + 1);
+	if (!next || len >= out_sz) {
+		*got = -1;
+		return json_skip_value(p, end);
+	}
+	*got = 1;
+	return next;
 }
 
-static int
-json_get_int(const char *json, const char *key, int *value)
+/* Parses an array of names into a mask holding bit i for names[i], as for topics and fields. */
+static const char *
+request_names(const char *p, const char *end, const char *const names[], size_t nnames, unsigned int *mask,
+		int *got)
+{
+	const char *start = p;
+	char name[32];
+	size_t i, len;
+
+	*got = -1;
+	if (p >= end || *p != '[')
+		return json_skip_value(p, end);
+	*mask = 0;
+	p = json_skip_ws(p + 1, end);
+	if (p < end && *p == ']') {
+		*got = 1;
+		return p + 1;
+	}
+
+	for (;;) {
+		if (!(p = json_read_string(p, end, name, sizeof(name), &len)) || len >= sizeof(name))
+			return json_skip_value(start, end);
+		for (i = 0; i < nnames; i++) {
+			if (!strcmp(name, names[i]))
+				break;
+		}
+		if (i == nnames)
+			return json_skip_value(start, end);
+		*mask |= 1u << i;
+		p = json_skip_ws(p, end);
+		if (p < end && *p == ']') {
+			*got = 1;
+			return p + 1;
+		}
+		if (p >= end || *p != ',')
+			return json_skip_value(start, end);
+		p = json_skip_ws(p + 1, end);
+	}
+}
+
+static const char *
+request_seq(const char *p, const char *end, unsigned long *value, int *got)
 {
-	char *end;
 	long parsed;
-	const char *p = find_key(json, key);
+	const char *next = json_read_int(p, end, &parsed);
 
-	if (!p)
-		return 0;
+	if (!next || parsed < 0) {
+		*got = -1;
+		return json_skip_value(p, end);
+	}
+	*value = (unsigned long)parsed;
+	*got = 1;
+	return next;
+}
 
-	errno = 0;
-	parsed = strtol(p, &end, 10);
-	if (errno || end == p)
-		return -1;
+static const char *
+request_id(const char *p, const char *end, unsigned int *value, int *got)
+{
+	long parsed;
+	const char *next = json_read_int(p, end, &parsed);
 
-	*value = (int)parsed;
-	return 1;
+	if (!next || parsed < 1 || parsed > UINT_MAX) {
+		*got = -1;
+		return json_skip_value(p, end);
+	}
+	*value = (unsigned int)parsed;
+	*got = 1;
+	return next;
 }
 
-static int
-json_get_string(const char *json, const char *key, char *out, size_t out_sz)
+static const char *
+request_bool(const char *p, const char *end, bool *value, int *got)
 {
-	size_t i = 0;
-	const char *p = find_key(json, key);
+	if (end - p >= 4 && !memcmp(p, "true", 4)) {
+		*value = true;
+		*got = 1;
+		return p + 4;
+	}
+	if (end - p >= 5 && !memcmp(p, "false", 5)) {
+		*value = false;
+		*got = 1;
+		return p + 5;
+	}
+	*got = -1;
+	return json_skip_value(p, end);
+}
 
-	if (!p)
-		return 0;
-	if (*p != '"')
-		return -1;
-	p++;
+/* Parses an array of at most `max` positive ids. */
+static const char *
+request_ids(const char *p, const char *end, unsigned int *ids, size_t max, size_t *n, int *got)
+{
+	const char *start = p;
+	long parsed;
 
-	while (*p && *p != '"') {
-		char ch = *p++;
-		if (ch == '\\') {
-			if (!*p)
-				return -1;
-			ch = *p++;
-			switch (ch) {
-			case '"':
-			case '\\':
-			case '/':
-				break;
-			case 'b':
-				ch = '\b';
-				break;
-			case 'f':
-				ch = '\f';
-				break;
-			case 'n':
-				ch = '\n';
-				break;
-			case 'r':
-				ch = '\r';
-				break;
-			case 't':
-				ch = '\t';
-				break;
-			default:
-				return -1;
-			}
+	*got = -1;
+	if (p >= end || *p != '[')
+		return json_skip_value(p, end);
+	*n = 0;
+	p = json_skip_ws(p + 1, end);
+	if (p < end && *p == ']') {
+		*got = 1;
+		return p + 1;
+	}
+
+	for (;;) {
+		if (!(p = json_read_int(p, end, &parsed)) || parsed < 1 || parsed > UINT_MAX || *n == max)
+			return json_skip_value(start, end);
+		ids[(*n)++] = (unsigned int)parsed;
+		p = json_skip_ws(p, end);
+		if (p < end && *p == ']') {
+			*got = 1;
+			return p + 1;
 		}
-		if (i + 1 >= out_sz)
-			return -1;
-		out[i++] = ch;
+		if (p >= end || *p != ',')
+			return json_skip_value(start, end);
+		p = json_skip_ws(p + 1, end);
 	}
+}
 
-	if (*p != '"')
-		return -1;
-	out[i] = '\0';
-	return 1;
+static const char *
+request_field(IPCRequest *req, const char *key, const char *p, const char *end)
+{
+	if (!strcmp(key, "id"))
+		return request_int(p, end, &req->id, &req->got_id);
+	if (!strcmp(key, "type"))
+		return request_string(p, end, req->type, sizeof(req->type), &req->got_type);
+	if (!strcmp(key, "mode"))
+		return request_string(p, end, req->mode, sizeof(req->mode), &req->got_mode);
+	if (!strcmp(key, "protocol"))
+		return request_string(p, end, req->protocol, sizeof(req->protocol), &req->got_protocol);
+	if (!strcmp(key, "topics"))
+		return request_names(p, end, ipc_topic_names, LENGTH(ipc_topic_names), &req->topics, &req->got_topics);
+	if (!strcmp(key, "fields"))
+		return request_names(p, end, ipc_field_names, LENGTH(ipc_field_names), &req->fields, &req->got_fields);
+	if (!strcmp(key, "only_populated"))
+		return request_bool(p, end, &req->only_populated, &req->got_only_populated);
+	if (!strcmp(key, "since_seq"))
+		return request_seq(p, end, &req->since_seq, &req->got_since_seq);
+	if (!strcmp(key, "max_hz"))
+		return request_int(p, end, &req->max_hz, &req->got_max_hz);
+	if (!strcmp(key, "clients"))
+		return request_ids(p, end, req->clients, LENGTH(req->clients), &req->nclients, &req->got_clients);
+	if (!strcmp(key, "workspace_id"))
+		return request_int(p, end, &req->workspace_id, &req->got_workspace_id);
+	if (!strcmp(key, "client_id"))
+		return request_id(p, end, &req->client_id, &req->got_client_id);
+	if (!strcmp(key, "vout_id"))
+		return request_int(p, end, &req->vout_id, &req->got_vout_id);
+	if (!strcmp(key, "output"))
+		return request_string(p, end, req->output, sizeof(req->output), &req->got_output);
+	if (!strcmp(key, "vout_name"))
+		return request_string(p, end, req->vout_name, sizeof(req->vout_name), &req->got_vout_name);
+	if (!strcmp(key, "command"))
+		return request_string(p, end, req->command, sizeof(req->command), &req->got_command);
+	if (!strcmp(key, "condition"))
+		return request_string(p, end, req->condition, sizeof(req->condition), &req->got_condition);
+	if (!strcmp(key, "app_id"))
+		return request_string(p, end, req->app_id, sizeof(req->app_id), &req->got_app_id);
+	if (!strcmp(key, "timeout_ms"))
+		return request_int(p, end, &req->timeout_ms, &req->got_timeout_ms);
+	if (!strcmp(key, "commands")) {
+		req->got_commands = p < end && *p == '[' ? 1 : -1;
+		req->commands = p;
+		req->commands_end = json_skip_value(p, end);
+		return req->commands_end;
+	}
+	return json_skip_value(p, end);
 }
 
-static void
-json_write_escaped(FILE *fp, const char *value)
+/*
+ * Extracts every field handle_request() looks at in one pass over the request
+ * object at [p, end). Unknown keys are skipped; a field with the wrong type is
+ * marked invalid (-1) without failing the parse, matching a missing one (0).
+ * Returns the position after the object, or NULL if it is malformed.
+ */
+static const char *
+parse_request(IPCRequest *req, const char *p, const char *end)
 {
-	const unsigned char *p = (const unsigned char *)(value ? value : "");
+	char key[32];
+	size_t key_len;
 
-	fputc('"', fp);
-	for (; *p; p++) {
-		switch (*p) {
-		case '"':
-			fputs("\\\"", fp);
-			break;
-		case '\\':
-			fputs("\\\\", fp);
-			break;
-		case '\b':
-			fputs("\\b", fp);
-			break;
-		case '\f':
-			fputs("\\f", fp);
-			break;
-		case '\n':
-			fputs("\\n", fp);
-			break;
-		case '\r':
-			fputs("\\r", fp);
-			break;
-		case '\t':
-			fputs("\\t", fp);
-			break;
-		default:
-			if (*p < 0x20)
-				fprintf(fp, "\\u%04x", *p);
-			else
-				fputc(*p, fp);
-			break;
-		}
+	memset(req, 0, sizeof(*req));
+	req->topics = IPC_TOPIC_ALL;
+	req->fields = IPC_FIELD_ALL;
+	p = json_skip_ws(p, end);
+	if (p >= end || *p != '{')
+		return NULL;
+	p = json_skip_ws(p + 1, end);
+	if (p < end && *p == '}')
+		return p + 1;
+
+	for (;;) {
+		if (!(p = json_read_string(p, end, key, sizeof(key), &key_len)))
+			return NULL;
+		p = json_skip_ws(p, end);
+		if (p >= end || *p != ':')
+			return NULL;
+		p = json_skip_ws(p + 1, end);
+		if (key_len >= sizeof(key))
+			p = json_skip_value(p, end);
+		else
+			p = request_field(req, key, p, end);
+		if (!p)
+			return NULL;
+		p = json_skip_ws(p, end);
+		if (p < end && *p == '}')
+			return p + 1;
+		if (p >= end || *p != ',')
+			return NULL;
+		p = json_skip_ws(p + 1, end);
 	}
-	fputc('"', fp);
 }
 
 static void
-json_write_box(FILE *fp, const struct wlr_box *box)
+json_write_box(JsonBuf *buf, const struct wlr_box *box)
 {
-	fprintf(fp, "{\"x\":%d,\"y\":%d,\"width\":%d,\"height\":%d}", box->x, box->y, box->width, box->height);
+	json_write_str(buf, "{\"x\":");
+	json_write_int(buf, box->x);
+	json_write_str(buf, ",\"y\":");
+	json_write_int(buf, box->y);
+	json_write_str(buf, ",\"width\":");
+	json_write_int(buf, box->width);
+	json_write_str(buf, ",\"height\":");
+	json_write_int(buf, box->height);
+	json_write_char(buf, '}');
 }
 
 static const char *
@@ -210,448 +624,2620 @@ pointer_reveal_edge_name(int edge)
 	}
 }
 
-static void
-workspace_stats(Workspace *ws, unsigned int *count, int *urgent)
+static char *
+model_strdup(const char *value)
 {
-	Client *c;
+	char *copy = strdup(value ? value : "");
 
-	*count = 0;
-	*urgent = 0;
-	wl_list_for_each(c, &clients, link) {
-		if (c->ws != ws)
-			continue;
-		(*count)++;
-		if (c->isurgent)
-			*urgent = 1;
-	}
+	if (!copy)
+		die("strdup:");
+	return copy;
 }
 
-static char *
-build_snapshot(void)
+static int
+model_monitor_index(Monitor *target)
 {
-	char *buf = NULL;
-	size_t size = 0;
-	FILE *fp = open_memstream(&buf, &size);
 	Monitor *m;
-	Monitor *pointer_mon;
-	VirtualOutput *vout;
-	int i;
+	int i = 0;
 
-	if (!fp)
-		return NULL;
-
-	fprintf(fp, "{\"type\":\"snapshot\",");
-
-	fprintf(fp, "\"focused_output\":");
-	if (selmon && selmon->wlr_output)
-		json_write_escaped(fp, selmon->wlr_output->name);
-	else
-		fputs("null", fp);
-
-	fprintf(fp, ",\"focused_virtual_output\":");
-	if (selvout)
-		fprintf(fp, "%u", selvout->id);
-	else
-		fputs("null", fp);
+	if (!target)
+		return -1;
+	wl_list_for_each(m, &mons, link) {
+		if (m == target)
+			return i;
+		i++;
+	}
+	return -1;
+}
 
-	fprintf(fp, ",\"focused_workspace\":");
-	if (selws)
-		fprintf(fp, "%u", selws->id);
-	else
-		fputs("null", fp);
+static const char *
+model_output_name(const IPCModel *model, int index)
+{
+	if (index < 0 || (size_t)index >= model->noutputs)
+		return NULL;
+	return model->outputs[index].name;
+}
 
-	pointer_mon = cursor ? xytomon(cursor->x, cursor->y) : NULL;
-	fputs(",\"pointer\":{", fp);
-	fputs("\"output\":", fp);
-	if (pointer_mon && pointer_mon->wlr_output)
-		json_write_escaped(fp, pointer_mon->wlr_output->name);
-	else
-		fputs("null", fp);
-	fprintf(fp, ",\"reveal_hover\":%s", ipc_pointer_reveal_hover ? "true" : "false");
-	fputs(",\"reveal_edge\":", fp);
-	{
-		const char *edge_name = pointer_reveal_edge_name(ipc_pointer_reveal_edge);
-		if (edge_name)
-			json_write_escaped(fp, edge_name);
-		else
-			fputs("null", fp);
-	}
-	fputc('}', fp);
+static IPCModel *
+ipc_model_capture(void)
+{
+	IPCModel *model = ecalloc(1, sizeof(*model));
+	Monitor *m;
+	VirtualOutput *vout;
+	size_t nvouts = 0;
+	size_t oi = 0, vi = 0;
+	int i;
 
-	fputs(",\"outputs\":[", fp);
-	{
-		bool first = true;
-		wl_list_for_each(m, &mons, link) {
-			Client *focused;
-			VirtualOutput *active_vout;
+	model->refs = 1;
+	model->noutputs = (size_t)wl_list_length(&mons);
+	wl_list_for_each(m, &mons, link) nvouts += (size_t)wl_list_length(&m->vouts);
+	model->nvouts = nvouts;
+	model->outputs = ecalloc(MAX(model->noutputs, 1), sizeof(*model->outputs));
+	model->vouts = ecalloc(MAX(model->nvouts, 1), sizeof(*model->vouts));
 
-			if (!first)
-				fputc(',', fp);
-			first = false;
+	model->focused_output = selmon && selmon->wlr_output ? model_monitor_index(selmon) : -1;
+	model->focused_vout = selvout ? (int)selvout->id : -1;
+	model->focused_workspace = selws ? (int)selws->id : -1;
+	model->pointer_output = cursor ? model_monitor_index(xytomon(cursor->x, cursor->y)) : -1;
+	model->reveal_hover = ipc_pointer_reveal_hover;
+	model->reveal_edge = ipc_pointer_reveal_edge;
 
-			fprintf(fp, "{\"name\":");
-			json_write_escaped(fp, m->wlr_output ? m->wlr_output->name : "");
-			fprintf(fp, ",\"focused\":%s", m == selmon ? "true" : "false");
-			fputs(",\"geometry\":", fp);
-			json_write_box(fp, &m->monitor_area);
-			fputs(",\"workarea\":", fp);
-			json_write_box(fp, &m->window_area);
-
-			active_vout = focusedvout(m);
-			fprintf(fp, ",\"active_virtual_output\":");
-			if (active_vout)
-				fprintf(fp, "%u", active_vout->id);
-			else
-				fputs("null", fp);
-
-			focused = focustop(m);
-			fputs(",\"active_window\":", fp);
-			if (!focused) {
-				fputs("null", fp);
-			} else {
-				fprintf(fp, "{\"title\":");
-				json_write_escaped(fp, client_get_title(focused));
-				fprintf(fp, ",\"appid\":");
-				json_write_escaped(fp, client_get_appid(focused));
-				fprintf(fp, ",\"fullscreen\":%s", focused->isfullscreen ? "true" : "false");
-				fprintf(fp, ",\"floating\":false");
-				fprintf(fp, ",\"tabbed\":%s}",
-						active_vout && active_vout->lt[active_vout->sellt] &&
-										active_vout->lt[active_vout->sellt]
-														->arrange ==
-												tabbed
-								? "true"
-								: "false");
-			}
+	wl_list_for_each(m, &mons, link) {
+		IPCOutputModel *out = &model->outputs[oi];
+		VirtualOutput *active_vout = focusedvout(m);
+		Client *focused = focustop(m);
 
-			fputc('}', fp);
+		out->name = model_strdup(m->wlr_output ? m->wlr_output->name : "");
+		out->focused = m == selmon;
+		out->geometry = m->monitor_area;
+		out->workarea = m->window_area;
+		out->active_vout = active_vout ? (int)active_vout->id : -1;
+		if (focused) {
+			out->has_window = true;
+			out->window_id = focused->id;
+			out->title = model_strdup(client_get_title(focused));
+			out->appid = model_strdup(client_get_appid(focused));
+			out->fullscreen = focused->isfullscreen;
+			out->tabbed = active_vout && active_vout->lt[active_vout->sellt] &&
+					active_vout->lt[active_vout->sellt]->arrange == tabbed;
 		}
-	}
-	fputc(']', fp);
 
-	fputs(",\"virtual_outputs\":[", fp);
-	{
-		bool first = true;
-		wl_list_for_each(m, &mons, link) {
-			wl_list_for_each(vout, &m->vouts, link) {
-				unsigned int count = 0;
-				int urgent = 0;
-
-				if (!first)
-					fputc(',', fp);
-				first = false;
-
-				if (vout->ws)
-					workspace_stats(vout->ws, &count, &urgent);
-
-				fprintf(fp, "{\"id\":%u,\"name\":", vout->id);
-				json_write_escaped(fp, vout->name);
-				fprintf(fp, ",\"focused\":%s", vout == selvout ? "true" : "false");
-				fprintf(fp, ",\"workspace\":");
-				if (vout->ws)
-					fprintf(fp, "%u", vout->ws->id);
-				else
-					fputs("null", fp);
-				fprintf(fp, ",\"workspace_name\":");
-				if (vout->ws)
-					json_write_escaped(fp, vout->ws->name);
-				else
-					fputs("null", fp);
-				fprintf(fp, ",\"layout\":");
-				json_write_escaped(fp, vout->ltsymbol);
-				fprintf(fp, ",\"clients\":%u,\"urgent\":%s", count, urgent ? "true" : "false");
-				fprintf(fp, ",\"outputs\":[");
-				json_write_escaped(fp, m->wlr_output ? m->wlr_output->name : "");
-				fprintf(fp, "],\"regions\":[{\"output\":");
-				json_write_escaped(fp, m->wlr_output ? m->wlr_output->name : "");
-				fprintf(fp, ",\"geometry\":");
-				json_write_box(fp, &vout->layout_geom);
-				fprintf(fp, "}]}");
+		wl_list_for_each(vout, &m->vouts, link) {
+			IPCVoutModel *vm = &model->vouts[vi++];
+
+			vm->id = vout->id;
+			snprintf(vm->name, sizeof(vm->name), "%s", vout->name);
+			vm->output = (int)oi;
+			vm->focused = vout == selvout;
+			vm->workspace = vout->ws ? (int)vout->ws->id : -1;
+			if (vout->ws) {
+				snprintf(vm->workspace_name, sizeof(vm->workspace_name), "%s", vout->ws->name);
+				vm->clients = vout->ws->nclients;
+				vm->urgent = vout->ws->nurgent > 0;
 			}
+			snprintf(vm->layout, sizeof(vm->layout), "%s", vout->ltsymbol);
+			vm->geometry = vout->layout_geom;
 		}
+		oi++;
 	}
-	fputc(']', fp);
 
-	fputs(",\"workspaces\":[", fp);
-	{
-		bool first = true;
-		for (i = 0; i < WORKSPACE_COUNT; i++) {
-			Workspace *ws = &workspaces[i];
-			unsigned int count;
-			int urgent;
+	for (i = 0; i < WORKSPACE_COUNT; i++) {
+		Workspace *ws = &workspaces[i];
+		IPCWorkspaceModel *wm = &model->workspaces[i];
 
-			workspace_stats(ws, &count, &urgent);
-			if (!ws->vout && ws != selws && !urgent && count == 0)
-				continue;
+		if (!ws->vout && ws != selws && !ws->nclients)
+			continue;
 
-			if (!first)
-				fputc(',', fp);
-			first = false;
+		wm->listed = true;
+		snprintf(wm->name, sizeof(wm->name), "%s", ws->name);
+		wm->assigned = ws->vout != NULL;
+		wm->visible = ws->vout && ws->vout->ws == ws;
+		wm->focused = ws == selws;
+		wm->clients = ws->nclients;
+		wm->urgent = ws->nurgent > 0;
+		wm->output = ws->vout && ws->vout->mon && ws->vout->mon->wlr_output ? model_monitor_index(ws->vout->mon)
+										   : -1;
+		wm->vout = ws->vout ? (int)ws->vout->id : -1;
+		if (ws->vout)
+			snprintf(wm->vout_name, sizeof(wm->vout_name), "%s", ws->vout->name);
+	}
 
-			fprintf(fp, "{\"id\":%u,\"name\":", ws->id);
-			json_write_escaped(fp, ws->name);
-			fprintf(fp, ",\"assigned\":%s", ws->vout ? "true" : "false");
-			fprintf(fp, ",\"visible\":%s", ws->vout && ws->vout->ws == ws ? "true" : "false");
-			fprintf(fp, ",\"focused\":%s", ws == selws ? "true" : "false");
-			fprintf(fp, ",\"clients\":%u,\"urgent\":%s", count, urgent ? "true" : "false");
-			fprintf(fp, ",\"output\":");
-			if (ws->vout && ws->vout->mon && ws->vout->mon->wlr_output)
-				json_write_escaped(fp, ws->vout->mon->wlr_output->name);
-			else
-				fputs("null", fp);
-			fprintf(fp, ",\"virtual_output\":");
-			if (ws->vout)
-				fprintf(fp, "%u", ws->vout->id);
-			else
-				fputs("null", fp);
-			fprintf(fp, ",\"virtual_output_name\":");
-			if (ws->vout)
-				json_write_escaped(fp, ws->vout->name);
-			else
-				fputs("null", fp);
-			fputc('}', fp);
-		}
-	}
-	fputs("]}", fp);
-
-	fclose(fp);
-	return buf;
+	return model;
 }
 
-static char *
-build_ok_reply(int id)
+/* Frees the serialized forms of the model; they are rebuilt if needed again. */
+static void
+ipc_model_drop_serialized(IPCModel *model)
 {
-	char *buf = NULL;
-	size_t size = 0;
-	FILE *fp = open_memstream(&buf, &size);
-
-	if (!fp)
-		return NULL;
+	size_t i;
 
-	fprintf(fp, "{\"id\":%d,\"ok\":true}", id);
-	fclose(fp);
-	return buf;
+	for (i = 0; i < LENGTH(model->snapshots); i++) {
+		free(model->snapshots[i]);
+		free(model->events[i]);
+		free(model->frames[i]);
+		model->snapshots[i] = model->events[i] = model->frames[i] = NULL;
+	}
+	for (i = 0; i < model->nviews; i++) {
+		free(model->views[i].snapshot);
+		free(model->views[i].event);
+	}
+	free(model->views);
+	model->views = NULL;
+	model->nviews = 0;
 }
 
-static char *
-build_error_reply(int id, const char *error)
+static void
+ipc_model_unref(IPCModel *model)
 {
-	char *buf = NULL;
-	size_t size = 0;
-	FILE *fp = open_memstream(&buf, &size);
-
-	if (!fp)
-		return NULL;
+	size_t i;
 
-	fprintf(fp, "{\"id\":%d,\"ok\":false,\"error\":", id);
-	json_write_escaped(fp, error);
-	fputc('}', fp);
-	fclose(fp);
-	return buf;
+	if (!model || --model->refs > 0)
+		return;
+	for (i = 0; i < model->noutputs; i++) {
+		free(model->outputs[i].name);
+		free(model->outputs[i].title);
+		free(model->outputs[i].appid);
+	}
+	ipc_model_drop_serialized(model);
+	free(model->outputs);
+	free(model->vouts);
+	free(model);
 }
 
-static char *
-build_state_reply(int id, const char *snapshot)
+static void
+json_write_optional_string(JsonBuf *buf, const char *value)
 {
-	char *buf = NULL;
-	size_t size = 0;
-	FILE *fp = open_memstream(&buf, &size);
-
-	if (!fp)
-		return NULL;
-
-	fprintf(fp, "{\"id\":%d,\"ok\":true,\"state\":", id);
-	fputs(snapshot, fp);
-	fputc('}', fp);
-	fclose(fp);
-	return buf;
+	if (value)
+		json_write_escaped(buf, value);
+	else
+		json_write_str(buf, "null");
 }
 
-static char *
-build_event(const char *snapshot)
+static void
+json_write_optional_id(JsonBuf *buf, int id)
 {
-	char *buf = NULL;
-	size_t size = 0;
-	FILE *fp = open_memstream(&buf, &size);
-
-	if (!fp)
-		return NULL;
+	if (id >= 0)
+		json_write_int(buf, id);
+	else
+		json_write_str(buf, "null");
+}
 
-	fprintf(fp, "{\"type\":\"event\",\"event\":\"state\",\"state\":");
-	fputs(snapshot, fp);
-	fputc('}', fp);
-	fclose(fp);
-	return buf;
+static void
+json_write_pointer(JsonBuf *buf, const IPCModel *model)
+{
+	json_write_str(buf, "{\"output\":");
+	json_write_optional_string(buf, model_output_name(model, model->pointer_output));
+	json_write_str(buf, ",\"reveal_hover\":");
+	json_write_bool(buf, model->reveal_hover);
+	json_write_str(buf, ",\"reveal_edge\":");
+	json_write_optional_string(buf, pointer_reveal_edge_name(model->reveal_edge));
+	json_write_char(buf, '}');
 }
 
-static int
-ipc_send_line(IPCClient *client, const char *line)
+static void
+json_write_window(JsonBuf *buf, const IPCOutputModel *out)
 {
-	size_t len = strlen(line);
-	size_t off = 0;
+	if (!out->has_window) {
+		json_write_str(buf, "null");
+		return;
+	}
+	json_write_str(buf, "{\"id\":");
+	json_write_uint(buf, out->window_id);
+	json_write_str(buf, ",\"title\":");
+	json_write_escaped(buf, out->title);
+	json_write_str(buf, ",\"appid\":");
+	json_write_escaped(buf, out->appid);
+	json_write_str(buf, ",\"fullscreen\":");
+	json_write_bool(buf, out->fullscreen);
+	json_write_str(buf, ",\"floating\":false");
+	json_write_str(buf, ",\"tabbed\":");
+	json_write_bool(buf, out->tabbed);
+	json_write_char(buf, '}');
+}
 
-	while (off < len) {
-		ssize_t n = send(client->fd, line + off, len - off, MSG_NOSIGNAL);
-		if (n < 0) {
-			if (errno == EINTR)
-				continue;
-			return -1;
-		}
-		if (n == 0)
-			return -1;
-		off += (size_t)n;
+static void
+json_write_output(JsonBuf *buf, const IPCOutputModel *out, unsigned int topics)
+{
+	json_write_str(buf, "{\"name\":");
+	json_write_escaped(buf, out->name);
+	if (topics & IPC_TOPIC_OUTPUTS) {
+		json_write_str(buf, ",\"focused\":");
+		json_write_bool(buf, out->focused);
+		json_write_str(buf, ",\"geometry\":");
+		json_write_box(buf, &out->geometry);
+		json_write_str(buf, ",\"workarea\":");
+		json_write_box(buf, &out->workarea);
+		json_write_str(buf, ",\"active_virtual_output\":");
+		json_write_optional_id(buf, out->active_vout);
+	}
+	if (topics & IPC_TOPIC_WINDOWS) {
+		json_write_str(buf, ",\"active_window\":");
+		json_write_window(buf, out);
 	}
+	json_write_char(buf, '}');
+}
 
-	if (send(client->fd, "\n", 1, MSG_NOSIGNAL) != 1)
-		return -1;
-	return 0;
+static void
+json_write_vout(JsonBuf *buf, const IPCModel *model, const IPCVoutModel *vm)
+{
+	const char *output = model_output_name(model, vm->output);
+
+	json_write_str(buf, "{\"id\":");
+	json_write_uint(buf, vm->id);
+	json_write_str(buf, ",\"name\":");
+	json_write_escaped(buf, vm->name);
+	json_write_str(buf, ",\"focused\":");
+	json_write_bool(buf, vm->focused);
+	json_write_str(buf, ",\"workspace\":");
+	json_write_optional_id(buf, vm->workspace);
+	json_write_str(buf, ",\"workspace_name\":");
+	json_write_optional_string(buf, vm->workspace >= 0 ? vm->workspace_name : NULL);
+	json_write_str(buf, ",\"layout\":");
+	json_write_escaped(buf, vm->layout);
+	json_write_str(buf, ",\"clients\":");
+	json_write_uint(buf, vm->clients);
+	json_write_str(buf, ",\"urgent\":");
+	json_write_bool(buf, vm->urgent);
+	json_write_str(buf, ",\"outputs\":[");
+	json_write_escaped(buf, output);
+	json_write_str(buf, "],\"regions\":[{\"output\":");
+	json_write_escaped(buf, output);
+	json_write_str(buf, ",\"geometry\":");
+	json_write_box(buf, &vm->geometry);
+	json_write_str(buf, "}]}");
 }
 
-static int
-ipc_send_or_drop(IPCClient *client, char *line)
+static void
+json_write_workspace(JsonBuf *buf, const IPCModel *model, unsigned int id)
 {
-	if (!line || ipc_send_line(client, line) < 0) {
-		ipc_client_destroy(client);
-		free(line);
-		return -1;
-	}
-	free(line);
-	return 0;
+	const IPCWorkspaceModel *wm = &model->workspaces[id];
+
+	json_write_str(buf, "{\"id\":");
+	json_write_uint(buf, id);
+	json_write_str(buf, ",\"name\":");
+	json_write_escaped(buf, wm->name);
+	json_write_str(buf, ",\"assigned\":");
+	json_write_bool(buf, wm->assigned);
+	json_write_str(buf, ",\"visible\":");
+	json_write_bool(buf, wm->visible);
+	json_write_str(buf, ",\"focused\":");
+	json_write_bool(buf, wm->focused);
+	json_write_str(buf, ",\"clients\":");
+	json_write_uint(buf, wm->clients);
+	json_write_str(buf, ",\"urgent\":");
+	json_write_bool(buf, wm->urgent);
+	json_write_str(buf, ",\"output\":");
+	json_write_optional_string(buf, model_output_name(model, wm->output));
+	json_write_str(buf, ",\"virtual_output\":");
+	json_write_optional_id(buf, wm->vout);
+	json_write_str(buf, ",\"virtual_output_name\":");
+	json_write_optional_string(buf, wm->vout >= 0 ? wm->vout_name : NULL);
+	json_write_char(buf, '}');
 }
 
-static VirtualOutput *
-resolve_vout(const char *json, const char **error)
+/*
+ * Serializes the sections of the model selected by topics, narrowed to the
+ * IPC_FIELD_* keys in view and, with IPC_VIEW_POPULATED, to populated workspaces.
+ */
+static void
+json_write_snapshot(JsonBuf *buf, const IPCModel *model, unsigned int topics, unsigned int view)
 {
-	int vout_id;
-	char output_name[128];
-	char vout_name[WORKSPACE_NAME_LEN];
-	int got_output, got_name;
-	Monitor *m;
-	VirtualOutput *vout;
+	size_t i;
+	bool first = true;
 
-	got_output = json_get_string(json, "output", output_name, sizeof(output_name));
-	got_name = json_get_string(json, "vout_name", vout_name, sizeof(vout_name));
-	if (json_get_int(json, "vout_id", &vout_id) > 0) {
-		vout = voutbyid((unsigned int)vout_id);
-		if (!vout)
-			*error = "unknown virtual output";
-		return vout;
+	json_write_str(buf, "{\"type\":\"snapshot\"");
+	if ((topics & IPC_TOPIC_FOCUS) && (view & IPC_FIELD_FOCUSED_OUTPUT)) {
+		json_write_str(buf, ",\"focused_output\":");
+		json_write_optional_string(buf, model_output_name(model, model->focused_output));
 	}
-
-	if (got_name <= 0) {
-		*error = "missing virtual output reference";
-		return NULL;
+	if ((topics & IPC_TOPIC_FOCUS) && (view & IPC_FIELD_FOCUSED_VOUT)) {
+		json_write_str(buf, ",\"focused_virtual_output\":");
+		json_write_optional_id(buf, model->focused_vout);
 	}
-
-	if (got_output <= 0) {
-		*error = "missing output for named virtual output";
-		return NULL;
+	if ((topics & IPC_TOPIC_FOCUS) && (view & IPC_FIELD_FOCUSED_WORKSPACE)) {
+		json_write_str(buf, ",\"focused_workspace\":");
+		json_write_optional_id(buf, model->focused_workspace);
+	}
+	if ((topics & IPC_TOPIC_POINTER) && (view & IPC_FIELD_POINTER)) {
+		json_write_str(buf, ",\"pointer\":");
+		json_write_pointer(buf, model);
 	}
 
-	m = monitorbyname(output_name);
-	if (!m) {
-		*error = "unknown output";
-		return NULL;
+	if ((topics & (IPC_TOPIC_OUTPUTS | IPC_TOPIC_WINDOWS)) && (view & IPC_FIELD_OUTPUTS)) {
+		json_write_str(buf, ",\"outputs\":[");
+		for (i = 0; i < model->noutputs; i++) {
+			if (i)
+				json_write_char(buf, ',');
+			json_write_output(buf, &model->outputs[i], topics);
+		}
+		json_write_char(buf, ']');
 	}
+	if ((topics & IPC_TOPIC_OUTPUTS) && (view & IPC_FIELD_VOUTS)) {
+		json_write_str(buf, ",\"virtual_outputs\":[");
+		for (i = 0; i < model->nvouts; i++) {
+			if (i)
+				json_write_char(buf, ',');
+			json_write_vout(buf, model, &model->vouts[i]);
+		}
+		json_write_char(buf, ']');
+	}
+	if ((topics & IPC_TOPIC_WORKSPACES) && (view & IPC_FIELD_WORKSPACES)) {
+		json_write_str(buf, ",\"workspaces\":[");
+		for (i = 0; i < WORKSPACE_COUNT; i++) {
+			const IPCWorkspaceModel *wm = &model->workspaces[i];
 
-	if (!(vout = findvoutbyname(m, vout_name))) {
-		*error = "unknown virtual output";
-		return NULL;
+			if (!wm->listed || ((view & IPC_VIEW_POPULATED) && !wm->clients && !wm->visible))
+				continue;
+			if (!first)
+				json_write_char(buf, ',');
+			first = false;
+			json_write_workspace(buf, model, (unsigned int)i);
+		}
+		json_write_char(buf, ']');
 	}
+	json_write_char(buf, '}');
+}
 
-	return vout;
+static bool
+model_str_eq(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+	return !strcmp(a, b);
 }
 
-static int
-handle_request(IPCClient *client, const char *line)
+static bool
+model_box_eq(const struct wlr_box *a, const struct wlr_box *b)
 {
-	char type[64];
-	int id = 0;
-	int workspace_id;
-	int got_type;
-	const char *error = NULL;
-	char *reply = NULL;
-	char command[2048];
+	return a->x == b->x && a->y == b->y && a->width == b->width && a->height == b->height;
+}
 
-	if (json_get_int(line, "id", &id) < 0) {
-		return ipc_send_or_drop(client, build_error_reply(0, "invalid request id"));
-	}
+static bool
+model_outputs_match(const IPCModel *old, const IPCModel *cur)
+{
+	size_t i;
 
-	got_type = json_get_string(line, "type", type, sizeof(type));
-	if (got_type <= 0) {
-		return ipc_send_or_drop(client, build_error_reply(id, "missing request type"));
+	if (old->noutputs != cur->noutputs)
+		return false;
+	for (i = 0; i < cur->noutputs; i++) {
+		if (!model_str_eq(old->outputs[i].name, cur->outputs[i].name))
+			return false;
 	}
+	return true;
+}
 
-	if (!strcmp(type, "get_state")) {
-		char *snapshot = build_snapshot();
-		reply = snapshot ? build_state_reply(id, snapshot) : NULL;
-		free(snapshot);
-		return ipc_send_or_drop(client, reply ? reply : build_error_reply(id, "failed to build state"));
+static const IPCVoutModel *
+model_find_vout(const IPCModel *model, unsigned int id)
+{
+	size_t i;
+
+	for (i = 0; i < model->nvouts; i++) {
+		if (model->vouts[i].id == id)
+			return &model->vouts[i];
+	}
+	return NULL;
+}
+
+/* Delta events are written one per line; the caller appends the final newline. */
+static void
+delta_begin(JsonBuf *buf, int *count, const char *event)
+{
+	if ((*count)++)
+		json_write_char(buf, '\n');
+	json_write_str(buf, "{\"type\":\"event\",\"event\":");
+	json_write_escaped(buf, event);
+	json_write_str(buf, ",\"seq\":");
+	json_write_uint(buf, ipc_server.delta_seq);
+}
+
+static void
+delta_write_focus(JsonBuf *buf, int *count, const IPCModel *old, const IPCModel *cur)
+{
+	const char *output = model_output_name(cur, cur->focused_output);
+	bool output_changed = !model_str_eq(model_output_name(old, old->focused_output), output);
+	bool vout_changed = old->focused_vout != cur->focused_vout;
+	bool ws_changed = old->focused_workspace != cur->focused_workspace;
+
+	if (!output_changed && !vout_changed && !ws_changed)
+		return;
+	delta_begin(buf, count, "focus");
+	if (output_changed) {
+		json_write_str(buf, ",\"focused_output\":");
+		json_write_optional_string(buf, output);
+	}
+	if (vout_changed) {
+		json_write_str(buf, ",\"focused_virtual_output\":");
+		json_write_optional_id(buf, cur->focused_vout);
+	}
+	if (ws_changed) {
+		json_write_str(buf, ",\"focused_workspace\":");
+		json_write_optional_id(buf, cur->focused_workspace);
+	}
+	json_write_char(buf, '}');
+}
+
+static void
+delta_write_pointer(JsonBuf *buf, int *count, const IPCModel *old, const IPCModel *cur)
+{
+	const char *output = model_output_name(cur, cur->pointer_output);
+	bool output_changed = !model_str_eq(model_output_name(old, old->pointer_output), output);
+	bool hover_changed = old->reveal_hover != cur->reveal_hover;
+	bool edge_changed = old->reveal_edge != cur->reveal_edge;
+
+	if (!output_changed && !hover_changed && !edge_changed)
+		return;
+	delta_begin(buf, count, "pointer");
+	if (output_changed) {
+		json_write_str(buf, ",\"output\":");
+		json_write_optional_string(buf, output);
+	}
+	if (hover_changed) {
+		json_write_str(buf, ",\"reveal_hover\":");
+		json_write_bool(buf, cur->reveal_hover);
+	}
+	if (edge_changed) {
+		json_write_str(buf, ",\"reveal_edge\":");
+		json_write_optional_string(buf, pointer_reveal_edge_name(cur->reveal_edge));
+	}
+	json_write_char(buf, '}');
+}
+
+static void
+delta_write_output(JsonBuf *buf, int *count, const IPCOutputModel *old, const IPCOutputModel *cur)
+{
+	bool focused_changed = old->focused != cur->focused;
+	bool geometry_changed = !model_box_eq(&old->geometry, &cur->geometry);
+	bool workarea_changed = !model_box_eq(&old->workarea, &cur->workarea);
+	bool vout_changed = old->active_vout != cur->active_vout;
+
+	if (!focused_changed && !geometry_changed && !workarea_changed && !vout_changed)
+		return;
+	delta_begin(buf, count, "output");
+	json_write_str(buf, ",\"name\":");
+	json_write_escaped(buf, cur->name);
+	if (focused_changed) {
+		json_write_str(buf, ",\"focused\":");
+		json_write_bool(buf, cur->focused);
+	}
+	if (geometry_changed) {
+		json_write_str(buf, ",\"geometry\":");
+		json_write_box(buf, &cur->geometry);
+	}
+	if (workarea_changed) {
+		json_write_str(buf, ",\"workarea\":");
+		json_write_box(buf, &cur->workarea);
+	}
+	if (vout_changed) {
+		json_write_str(buf, ",\"active_virtual_output\":");
+		json_write_optional_id(buf, cur->active_vout);
+	}
+	json_write_char(buf, '}');
+}
+
+static void
+delta_write_title(JsonBuf *buf, int *count, const IPCOutputModel *old, const IPCOutputModel *cur)
+{
+	if (old->has_window != cur->has_window) {
+		delta_begin(buf, count, "title");
+		json_write_str(buf, ",\"output\":");
+		json_write_escaped(buf, cur->name);
+		json_write_str(buf, ",\"active_window\":");
+		json_write_window(buf, cur);
+		json_write_char(buf, '}');
+		return;
+	}
+	if (!cur->has_window)
+		return;
+
+	{
+		bool id_changed = old->window_id != cur->window_id;
+		bool title_changed = !model_str_eq(old->title, cur->title);
+		bool appid_changed = !model_str_eq(old->appid, cur->appid);
+		bool fullscreen_changed = old->fullscreen != cur->fullscreen;
+		bool tabbed_changed = old->tabbed != cur->tabbed;
+		bool first = true;
+
+		if (!id_changed && !title_changed && !appid_changed && !fullscreen_changed && !tabbed_changed)
+			return;
+		delta_begin(buf, count, "title");
+		json_write_str(buf, ",\"output\":");
+		json_write_escaped(buf, cur->name);
+		json_write_str(buf, ",\"active_window\":{");
+		if (id_changed) {
+			json_write_str(buf, "\"id\":");
+			json_write_uint(buf, cur->window_id);
+			first = false;
+		}
+		if (title_changed) {
+			json_write_str(buf, first ? "\"title\":" : ",\"title\":");
+			json_write_escaped(buf, cur->title);
+			first = false;
+		}
+		if (appid_changed) {
+			json_write_str(buf, first ? "\"appid\":" : ",\"appid\":");
+			json_write_escaped(buf, cur->appid);
+			first = false;
+		}
+		if (fullscreen_changed) {
+			json_write_str(buf, first ? "\"fullscreen\":" : ",\"fullscreen\":");
+			json_write_bool(buf, cur->fullscreen);
+			first = false;
+		}
+		if (tabbed_changed) {
+			json_write_str(buf, first ? "\"tabbed\":" : ",\"tabbed\":");
+			json_write_bool(buf, cur->tabbed);
+		}
+		json_write_str(buf, "}}");
+	}
+}
+
+static void
+delta_write_vout(JsonBuf *buf, int *count, const IPCModel *old_model, const IPCVoutModel *old,
+		const IPCModel *cur_model, const IPCVoutModel *cur)
+{
+	/* a vout missing from the old model is new and gets all of its fields */
+	bool name_changed = !old || strcmp(old->name, cur->name) != 0;
+	bool focused_changed = !old || old->focused != cur->focused;
+	bool ws_changed = !old || old->workspace != cur->workspace || strcmp(old->workspace_name, cur->workspace_name);
+	bool layout_changed = !old || strcmp(old->layout, cur->layout) != 0;
+	bool clients_changed = !old || old->clients != cur->clients;
+	bool urgent_changed = !old || old->urgent != cur->urgent;
+	const char *output = model_output_name(cur_model, cur->output);
+	bool region_changed = !old || !model_str_eq(model_output_name(old_model, old->output), output) ||
+			!model_box_eq(&old->geometry, &cur->geometry);
+
+	if (!name_changed && !focused_changed && !ws_changed && !layout_changed && !clients_changed &&
+			!urgent_changed && !region_changed)
+		return;
+	delta_begin(buf, count, "vout");
+	json_write_str(buf, ",\"id\":");
+	json_write_uint(buf, cur->id);
+	if (name_changed) {
+		json_write_str(buf, ",\"name\":");
+		json_write_escaped(buf, cur->name);
+	}
+	if (focused_changed) {
+		json_write_str(buf, ",\"focused\":");
+		json_write_bool(buf, cur->focused);
+	}
+	if (ws_changed) {
+		json_write_str(buf, ",\"workspace\":");
+		json_write_optional_id(buf, cur->workspace);
+		json_write_str(buf, ",\"workspace_name\":");
+		json_write_optional_string(buf, cur->workspace >= 0 ? cur->workspace_name : NULL);
+	}
+	if (layout_changed) {
+		json_write_str(buf, ",\"layout\":");
+		json_write_escaped(buf, cur->layout);
+	}
+	if (clients_changed) {
+		json_write_str(buf, ",\"clients\":");
+		json_write_uint(buf, cur->clients);
+	}
+	if (urgent_changed) {
+		json_write_str(buf, ",\"urgent\":");
+		json_write_bool(buf, cur->urgent);
+	}
+	if (region_changed) {
+		json_write_str(buf, ",\"outputs\":[");
+		json_write_escaped(buf, output);
+		json_write_str(buf, "],\"regions\":[{\"output\":");
+		json_write_escaped(buf, output);
+		json_write_str(buf, ",\"geometry\":");
+		json_write_box(buf, &cur->geometry);
+		json_write_str(buf, "}]");
+	}
+	json_write_char(buf, '}');
+}
+
+static void
+delta_write_workspace(JsonBuf *buf, int *count, const IPCModel *old_model, const IPCModel *cur_model, unsigned int id)
+{
+	const IPCWorkspaceModel *old = &old_model->workspaces[id];
+	const IPCWorkspaceModel *cur = &cur_model->workspaces[id];
+	const char *output = model_output_name(cur_model, cur->output);
+	/* a workspace that just became listed gets all of its fields */
+	bool all = !old->listed;
+	bool name_changed, assigned_changed, visible_changed, focused_changed;
+	bool clients_changed, urgent_changed, output_changed, vout_changed;
+
+	if (!old->listed && !cur->listed)
+		return;
+	if (!cur->listed) {
+		delta_begin(buf, count, "workspace");
+		json_write_str(buf, ",\"id\":");
+		json_write_uint(buf, id);
+		json_write_str(buf, ",\"removed\":true}");
+		return;
+	}
+
+	name_changed = all || strcmp(old->name, cur->name) != 0;
+	assigned_changed = all || old->assigned != cur->assigned;
+	visible_changed = all || old->visible != cur->visible;
+	focused_changed = all || old->focused != cur->focused;
+	clients_changed = all || old->clients != cur->clients;
+	urgent_changed = all || old->urgent != cur->urgent;
+	output_changed = all || !model_str_eq(model_output_name(old_model, old->output), output);
+	vout_changed = all || old->vout != cur->vout || strcmp(old->vout_name, cur->vout_name) != 0;
+	if (!name_changed && !assigned_changed && !visible_changed && !focused_changed && !clients_changed &&
+			!urgent_changed && !output_changed && !vout_changed)
+		return;
+
+	delta_begin(buf, count, "workspace");
+	json_write_str(buf, ",\"id\":");
+	json_write_uint(buf, id);
+	if (name_changed) {
+		json_write_str(buf, ",\"name\":");
+		json_write_escaped(buf, cur->name);
+	}
+	if (assigned_changed) {
+		json_write_str(buf, ",\"assigned\":");
+		json_write_bool(buf, cur->assigned);
+	}
+	if (visible_changed) {
+		json_write_str(buf, ",\"visible\":");
+		json_write_bool(buf, cur->visible);
+	}
+	if (focused_changed) {
+		json_write_str(buf, ",\"focused\":");
+		json_write_bool(buf, cur->focused);
+	}
+	if (clients_changed) {
+		json_write_str(buf, ",\"clients\":");
+		json_write_uint(buf, cur->clients);
+	}
+	if (urgent_changed) {
+		json_write_str(buf, ",\"urgent\":");
+		json_write_bool(buf, cur->urgent);
+	}
+	if (output_changed) {
+		json_write_str(buf, ",\"output\":");
+		json_write_optional_string(buf, output);
+	}
+	if (vout_changed) {
+		json_write_str(buf, ",\"virtual_output\":");
+		json_write_optional_id(buf, cur->vout);
+		json_write_str(buf, ",\"virtual_output_name\":");
+		json_write_optional_string(buf, cur->vout >= 0 ? cur->vout_name : NULL);
+	}
+	json_write_char(buf, '}');
+}
+
+/*
+ * Writes the delta events for the given topics between two models to buf, one
+ * event per line, and returns them, or NULL if nothing changed. Both models must
+ * have the same outputs; when they do not, subscribers need a full snapshot instead.
+ */
+static const char *
+build_deltas(JsonBuf *buf, const IPCModel *old, const IPCModel *cur, unsigned int topics)
+{
+	int count = 0;
+	size_t i;
+
+	json_buf_reset(buf);
+	ipc_server.delta_seq = cur->generation;
+	if (topics & IPC_TOPIC_FOCUS)
+		delta_write_focus(buf, &count, old, cur);
+	if (topics & IPC_TOPIC_POINTER)
+		delta_write_pointer(buf, &count, old, cur);
+	for (i = 0; i < cur->noutputs; i++) {
+		if (topics & IPC_TOPIC_OUTPUTS)
+			delta_write_output(buf, &count, &old->outputs[i], &cur->outputs[i]);
+		if (topics & IPC_TOPIC_WINDOWS)
+			delta_write_title(buf, &count, &old->outputs[i], &cur->outputs[i]);
+	}
+	if (topics & IPC_TOPIC_OUTPUTS) {
+		for (i = 0; i < old->nvouts; i++) {
+			if (!model_find_vout(cur, old->vouts[i].id)) {
+				delta_begin(buf, &count, "vout");
+				json_write_str(buf, ",\"id\":");
+				json_write_uint(buf, old->vouts[i].id);
+				json_write_str(buf, ",\"removed\":true}");
+			}
+		}
+		for (i = 0; i < cur->nvouts; i++) {
+			delta_write_vout(buf, &count, old, model_find_vout(old, cur->vouts[i].id), cur, &cur->vouts[i]);
+		}
+	}
+	if (topics & IPC_TOPIC_WORKSPACES) {
+		for (i = 0; i < WORKSPACE_COUNT; i++) delta_write_workspace(buf, &count, old, cur, (unsigned int)i);
+	}
+
+	return count ? json_buf_str(buf) : NULL;
+}
+
+/*
+ * Replies are built in a scratch buffer shared by all of them; the result is
+ * valid until the next reply is built.
+ */
+static JsonBuf *
+reply_begin(int id, bool ok)
+{
+	JsonBuf *buf = &ipc_server.scratch;
+
+	json_buf_reset(buf);
+	json_write_str(buf, "{\"id\":");
+	json_write_int(buf, id);
+	json_write_str(buf, ok ? ",\"ok\":true" : ",\"ok\":false");
+	return buf;
+}
+
+static const char *
+build_ok_reply(int id)
+{
+	JsonBuf *buf = reply_begin(id, true);
+
+	json_write_char(buf, '}');
+	return json_buf_str(buf);
+}
+
+static const char *
+build_error_reply(int id, const char *error)
+{
+	JsonBuf *buf = reply_begin(id, false);
+
+	json_write_str(buf, ",\"error\":");
+	json_write_escaped(buf, error);
+	json_write_char(buf, '}');
+	return json_buf_str(buf);
+}
+
+static const char *
+build_state_reply(int id, unsigned long seq, const char *snapshot)
+{
+	JsonBuf *buf = reply_begin(id, true);
+
+	json_write_str(buf, ",\"seq\":");
+	json_write_uint(buf, seq);
+	json_write_str(buf, ",\"state\":");
+	json_write_str(buf, snapshot);
+	json_write_char(buf, '}');
+	return json_buf_str(buf);
+}
+
+static const char *
+build_hello_reply(int id, bool binary)
+{
+	JsonBuf *buf = reply_begin(id, true);
+
+	json_write_str(buf, binary ? ",\"protocol\":\"binary\",\"version\":" : ",\"protocol\":\"json\",\"version\":");
+	json_write_int(buf, VWL_IPC_BINARY_VERSION);
+	json_write_char(buf, '}');
+	return json_buf_str(buf);
+}
+
+static const char *
+build_state_fd_reply(int id)
+{
+	JsonBuf *buf = reply_begin(id, true);
+
+	json_write_str(buf, ",\"size\":");
+	json_write_uint(buf, sizeof(struct VwlIpcShmState));
+	json_write_str(buf, ",\"version\":");
+	json_write_int(buf, VWL_IPC_SHM_VERSION);
+	json_write_char(buf, '}');
+	return json_buf_str(buf);
+}
+
+/* One metric's HELP and TYPE lines, in the Prometheus text format. */
+static void
+metrics_header(JsonBuf *buf, const char *name, const char *type, const char *help)
+{
+	json_write_str(buf, "# HELP ");
+	json_write_str(buf, name);
+	json_write_char(buf, ' ');
+	json_write_str(buf, help);
+	json_write_str(buf, "\n# TYPE ");
+	json_write_str(buf, name);
+	json_write_char(buf, ' ');
+	json_write_str(buf, type);
+	json_write_char(buf, '\n');
+}
+
+static void
+metrics_label(JsonBuf *buf, const char *key, const char *value)
+{
+	json_write_str(buf, key);
+	json_write_str(buf, "=\"");
+	for (; *value; value++) {
+		if (*value == '\n') {
+			json_write_str(buf, "\\n");
+			continue;
+		}
+		if (*value == '\\' || *value == '"')
+			json_write_char(buf, '\\');
+		json_write_char(buf, *value);
+	}
+	json_write_char(buf, '"');
+}
+
+static void
+metrics_value(JsonBuf *buf, unsigned long value)
+{
+	json_write_char(buf, ' ');
+	json_write_uint(buf, value);
+	json_write_char(buf, '\n');
+}
+
+/* A metric without labels. */
+static void
+metrics_single(JsonBuf *buf, const char *name, const char *type, const char *help, unsigned long value)
+{
+	metrics_header(buf, name, type, help);
+	json_write_str(buf, name);
+	metrics_value(buf, value);
+}
+
+static void
+build_metrics_text(JsonBuf *buf)
+{
+	Monitor *m;
+	VirtualOutput *vout;
+	unsigned long count = 0;
+	char num[32];
+	size_t i;
+
+	json_buf_reset(buf);
+	metrics_header(buf, "vwl_output_frames_total", "counter",
+			"Output frames handled by rendermon(), skipped while a client resize was outstanding.");
+	wl_list_for_each(m, &mons, link) {
+		json_write_str(buf, "vwl_output_frames_total{");
+		metrics_label(buf, "output", m->wlr_output->name);
+		json_write_str(buf, ",result=\"committed\"}");
+		metrics_value(buf, m->frames_committed);
+		json_write_str(buf, "vwl_output_frames_total{");
+		metrics_label(buf, "output", m->wlr_output->name);
+		json_write_str(buf, ",result=\"skipped\"}");
+		metrics_value(buf, m->frames_skipped);
+	}
+
+	metrics_header(buf, "vwl_arrange_duration_seconds", "histogram", "Time spent in arrange().");
+	for (i = 0; i < ARRANGE_BUCKETS; i++) {
+		count += metrics.arrange_buckets[i];
+		if (i < LENGTH(arrange_bucket_us))
+			snprintf(num, sizeof(num), "%g", arrange_bucket_us[i] / 1e6);
+		else
+			snprintf(num, sizeof(num), "+Inf");
+		json_write_str(buf, "vwl_arrange_duration_seconds_bucket{le=\"");
+		json_write_str(buf, num);
+		json_write_str(buf, "\"}");
+		metrics_value(buf, count);
+	}
+	snprintf(num, sizeof(num), "%.9f", (double)metrics.arrange_ns / 1e9);
+	json_write_str(buf, "vwl_arrange_duration_seconds_sum ");
+	json_write_str(buf, num);
+	json_write_str(buf, "\nvwl_arrange_duration_seconds_count");
+	metrics_value(buf, metrics.arranges);
+
+	metrics_single(buf, "vwl_ipc_updates_total", "counter", "State changes passed to updateipc().",
+			ipc_server.updates);
+	metrics_single(buf, "vwl_ipc_publishes_total", "counter", "Publishes the state changes were collapsed into.",
+			ipc_server.publishes);
+	metrics_header(buf, "vwl_ipc_sent_bytes_total", "counter", "Bytes accepted for sending to IPC clients.");
+	json_write_str(buf, "vwl_ipc_sent_bytes_total{kind=\"reply\"}");
+	metrics_value(buf, ipc_server.sent_bytes[false]);
+	json_write_str(buf, "vwl_ipc_sent_bytes_total{kind=\"event\"}");
+	metrics_value(buf, ipc_server.sent_bytes[true]);
+	metrics_single(buf, "vwl_ipc_dropped_events_total", "counter",
+			"State events discarded for subscribers that fell behind.", ipc_server.dropped_events);
+	metrics_single(buf, "vwl_ipc_dropped_clients_total", "counter", "IPC clients disconnected for falling behind.",
+			ipc_server.dropped_clients);
+	metrics_single(buf, "vwl_ipc_clients", "gauge", "Connected IPC clients.",
+			(unsigned long)wl_list_length(&ipc_server.clients));
+	metrics_single(buf, "vwl_pending_spawns", "gauge", "Workspace spawns still waiting for their first window.",
+			spawnrules_pending());
+
+	metrics_header(buf, "vwl_capture_frames_total", "counter", "Frames produced for image capture sources.");
+	json_write_str(buf, "vwl_capture_frames_total{source=\"toplevel\"}");
+	metrics_value(buf, metrics.toplevel_capture_frames);
+	wl_list_for_each(m, &mons, link) {
+		wl_list_for_each(vout, &m->vouts, link) {
+			json_write_str(buf, "vwl_capture_frames_total{source=\"vout\",");
+			metrics_label(buf, "output", m->wlr_output->name);
+			json_write_char(buf, ',');
+			metrics_label(buf, "vout", vout->name);
+			json_write_char(buf, '}');
+			metrics_value(buf, vout->capture_frames);
+		}
+	}
+}
+
+static const char *
+build_metrics_reply(int id)
+{
+	JsonBuf *buf;
+
+	build_metrics_text(&ipc_server.metrics);
+	buf = reply_begin(id, true);
+	json_write_str(buf, ",\"metrics\":");
+	json_write_escaped(buf, json_buf_str(&ipc_server.metrics));
+	json_write_char(buf, '}');
+	return json_buf_str(buf);
+}
+
+static const char *
+build_stats_reply(int id)
+{
+	JsonBuf *buf = reply_begin(id, true);
+
+	json_write_str(buf, ",\"stats\":{\"updates\":");
+	json_write_uint(buf, ipc_server.updates);
+	json_write_str(buf, ",\"publishes\":");
+	json_write_uint(buf, ipc_server.publishes);
+	json_write_str(buf, ",\"generation\":");
+	json_write_uint(buf, ipc_server.generation);
+	json_write_str(buf, "}}");
+	return json_buf_str(buf);
+}
+
+/* Where the client is now; ipc_geom, ipc_vout and ipc_visible hold what watchers were last sent. */
+static void
+geometry_current(Client *c, struct wlr_box *box, int *vout, int *visible)
+{
+	*box = c->geom;
+	*vout = c->ws && c->ws->vout ? (int)c->ws->vout->id : -1;
+	*visible = c->scene && c->scene->node.enabled;
+}
+
+static bool
+geometry_watched(const IPCClient *client, unsigned int id)
+{
+	size_t i;
+
+	if (!client->ngeom_ids)
+		return true;
+	for (i = 0; i < client->ngeom_ids; i++) {
+		if (client->geom_ids[i] == id)
+			return true;
+	}
+	return false;
+}
+
+static void
+json_write_geometry(JsonBuf *buf, int *count, unsigned int id, const struct wlr_box *box, int vout, int visible)
+{
+	if ((*count)++)
+		json_write_char(buf, ',');
+	json_write_str(buf, "{\"id\":");
+	json_write_uint(buf, id);
+	json_write_str(buf, ",\"geometry\":");
+	json_write_box(buf, box);
+	json_write_str(buf, ",\"virtual_output\":");
+	json_write_optional_id(buf, vout);
+	json_write_str(buf, ",\"visible\":");
+	json_write_bool(buf, visible);
+	json_write_char(buf, '}');
+}
+
+/* Every mapped window the client watches, as it is now. */
+static void
+json_write_geometry_all(JsonBuf *buf, int *count, const IPCClient *client)
+{
+	struct wlr_box box;
+	int vout, visible;
+	Client *c;
+
+	wl_list_for_each(c, &clients, link) {
+		if (client_is_unmanaged(c) || !geometry_watched(client, c->id))
+			continue;
+		geometry_current(c, &box, &vout, &visible);
+		json_write_geometry(buf, count, c->id, &box, vout, visible);
+	}
+}
+
+static const char *
+build_geometry_reply(int id, const IPCClient *client)
+{
+	JsonBuf *buf = reply_begin(id, true);
+	int count = 0;
+
+	json_write_str(buf, ",\"windows\":[");
+	if (client->geom_watch)
+		json_write_geometry_all(buf, &count, client);
+	json_write_str(buf, "]}");
+	return json_buf_str(buf);
+}
+
+/* Nothing was tracked while nobody watched, so what watchers were last sent is stale. */
+static void
+geometry_forget(void)
+{
+	Client *c;
+
+	wl_list_for_each(c, &clients, link) c->ipc_visible = -1;
+}
+
+/*
+ * The geometry event for one watcher: the windows in `batch` it watches, or all
+ * of them after a resync, and the ones unmapped since the last frame. Returns
+ * NULL if none of it concerns the watcher.
+ */
+static const char *
+build_geometry_event(IPCClient *client, struct wl_list *batch)
+{
+	JsonBuf *buf = &ipc_server.scratch;
+	Client *c;
+	size_t i;
+	int count = 0;
+
+	json_buf_reset(buf);
+	json_write_str(buf, "{\"type\":\"event\",\"event\":\"geometry\",\"windows\":[");
+	if (client->geom_resync) {
+		client->geom_resync = false;
+		json_write_geometry_all(buf, &count, client);
+	} else {
+		wl_list_for_each(c, batch, ipc_geom_link) {
+			if (geometry_watched(client, c->id))
+				json_write_geometry(buf, &count, c->id, &c->ipc_geom, c->ipc_vout, c->ipc_visible);
+		}
+	}
+	for (i = 0; i < ipc_server.ngeom_unmapped; i++) {
+		if (!geometry_watched(client, ipc_server.geom_unmapped[i]))
+			continue;
+		if (count++)
+			json_write_char(buf, ',');
+		json_write_str(buf, "{\"id\":");
+		json_write_uint(buf, ipc_server.geom_unmapped[i]);
+		json_write_str(buf, ",\"mapped\":false}");
+	}
+	if (!count)
+		return NULL;
+	json_write_str(buf, "]}");
+	return json_buf_str(buf);
+}
+
+/* The cache entry for a narrowed snapshot of the model, added on first use. */
+static IPCModelView *
+model_view(IPCModel *model, unsigned int topics, unsigned int view)
+{
+	IPCModelView *mv;
+	size_t i;
+
+	for (i = 0; i < model->nviews; i++) {
+		if (model->views[i].topics == topics && model->views[i].view == view)
+			return &model->views[i];
+	}
+	mv = realloc(model->views, (model->nviews + 1) * sizeof(*model->views));
+	if (!mv)
+		die("realloc:");
+	model->views = mv;
+	mv = &model->views[model->nviews++];
+	*mv = (IPCModelView){.topics = topics, .view = view};
+	return mv;
+}
+
+/*
+ * Serialized state for a topic set and view, built once per model and shared by
+ * every reply. The full view of each topic set has a slot of its own.
+ */
+static const char *
+model_snapshot(IPCModel *model, unsigned int topics, unsigned int view)
+{
+	char **snapshot = &model->snapshots[topics];
+
+	if (view != IPC_FIELD_ALL)
+		snapshot = &model_view(model, topics, view)->snapshot;
+	if (!*snapshot) {
+		json_buf_reset(&ipc_server.scratch);
+		json_write_snapshot(&ipc_server.scratch, model, topics, view);
+		*snapshot = json_buf_dup(&ipc_server.scratch);
+	}
+	return *snapshot;
+}
+
+static const char *
+model_state_event(IPCModel *model, unsigned int topics, unsigned int view)
+{
+	const char *snapshot = model_snapshot(model, topics, view);
+	char **event = &model->events[topics];
+
+	if (view != IPC_FIELD_ALL)
+		event = &model_view(model, topics, view)->event;
+	if (!*event) {
+		json_buf_reset(&ipc_server.scratch);
+		json_write_str(&ipc_server.scratch, "{\"type\":\"event\",\"event\":\"state\",\"seq\":");
+		json_write_uint(&ipc_server.scratch, model->generation);
+		json_write_str(&ipc_server.scratch, ",\"state\":");
+		json_write_str(&ipc_server.scratch, snapshot);
+		json_write_char(&ipc_server.scratch, '}');
+		*event = json_buf_dup(&ipc_server.scratch);
+	}
+	return *event;
+}
+
+/* One binary record being built, with the strings its trailing VwlIpcString fields refer to. */
+typedef struct IPCBinRecord {
+	union {
+		struct VwlIpcRecord rec;
+		struct VwlIpcFocus focus;
+		struct VwlIpcPointer pointer;
+		struct VwlIpcOutput output;
+		struct VwlIpcWindow window;
+		struct VwlIpcVout vout;
+		struct VwlIpcWorkspace workspace;
+	} u;
+	int nstrings;
+	const char *strings[3];
+} IPCBinRecord;
+
+static void
+bin_begin(IPCBinRecord *r, enum VwlIpcRecordKind kind, size_t size)
+{
+	memset(r, 0, sizeof(*r));
+	r->u.rec.kind = (uint16_t)kind;
+	r->u.rec.size = (uint16_t)size;
+}
+
+static void
+bin_add_string(IPCBinRecord *r, const char *value)
+{
+	r->strings[r->nstrings++] = value;
+}
+
+static void
+bin_focus(IPCBinRecord *r, const IPCModel *model)
+{
+	bin_begin(r, VWL_IPC_RECORD_FOCUS, sizeof(r->u.focus));
+	r->u.focus.output = model->focused_output;
+	r->u.focus.vout = model->focused_vout;
+	r->u.focus.workspace = model->focused_workspace;
+}
+
+static void
+bin_pointer(IPCBinRecord *r, const IPCModel *model)
+{
+	bin_begin(r, VWL_IPC_RECORD_POINTER, sizeof(r->u.pointer));
+	r->u.pointer.output = model->pointer_output;
+	r->u.pointer.reveal_hover = model->reveal_hover;
+	/* POINTER_REVEAL_EDGE_* and VWL_IPC_EDGE_* share their order */
+	r->u.pointer.reveal_edge = (uint8_t)(pointer_reveal_edge_name(model->reveal_edge) ? model->reveal_edge : 0);
+}
+
+static void
+bin_box(struct VwlIpcBox *out, const struct wlr_box *box)
+{
+	out->x = box->x;
+	out->y = box->y;
+	out->width = box->width;
+	out->height = box->height;
+}
+
+static void
+bin_output(IPCBinRecord *r, const IPCModel *model, size_t i)
+{
+	const IPCOutputModel *out = &model->outputs[i];
+
+	bin_begin(r, VWL_IPC_RECORD_OUTPUT, sizeof(r->u.output));
+	r->u.output.index = (int32_t)i;
+	bin_box(&r->u.output.geometry, &out->geometry);
+	bin_box(&r->u.output.workarea, &out->workarea);
+	r->u.output.active_vout = out->active_vout;
+	r->u.output.focused = out->focused;
+	bin_add_string(r, out->name);
+}
+
+static void
+bin_window(IPCBinRecord *r, const IPCModel *model, size_t i)
+{
+	const IPCOutputModel *out = &model->outputs[i];
+
+	bin_begin(r, VWL_IPC_RECORD_WINDOW, sizeof(r->u.window));
+	r->u.window.output = (int32_t)i;
+	r->u.window.present = out->has_window;
+	r->u.window.fullscreen = out->has_window && out->fullscreen;
+	r->u.window.tabbed = out->has_window && out->tabbed;
+	bin_add_string(r, out->has_window ? out->title : NULL);
+	bin_add_string(r, out->has_window ? out->appid : NULL);
+}
+
+static void
+bin_vout(IPCBinRecord *r, const IPCVoutModel *vm)
+{
+	bin_begin(r, VWL_IPC_RECORD_VOUT, sizeof(r->u.vout));
+	r->u.vout.id = vm->id;
+	r->u.vout.output = vm->output;
+	r->u.vout.workspace = vm->workspace;
+	r->u.vout.clients = vm->clients;
+	bin_box(&r->u.vout.geometry, &vm->geometry);
+	r->u.vout.focused = vm->focused;
+	r->u.vout.urgent = vm->urgent;
+	bin_add_string(r, vm->name);
+	bin_add_string(r, vm->workspace >= 0 ? vm->workspace_name : NULL);
+	bin_add_string(r, vm->layout);
+}
+
+static void
+bin_workspace(IPCBinRecord *r, const IPCModel *model, unsigned int id)
+{
+	const IPCWorkspaceModel *wm = &model->workspaces[id];
+
+	bin_begin(r, VWL_IPC_RECORD_WORKSPACE, sizeof(r->u.workspace));
+	r->u.workspace.id = id;
+	r->u.workspace.output = wm->output;
+	r->u.workspace.vout = wm->vout;
+	r->u.workspace.clients = wm->clients;
+	r->u.workspace.assigned = wm->assigned;
+	r->u.workspace.visible = wm->visible;
+	r->u.workspace.focused = wm->focused;
+	r->u.workspace.urgent = wm->urgent;
+	bin_add_string(r, wm->name);
+	bin_add_string(r, wm->vout >= 0 ? wm->vout_name : NULL);
+}
+
+/* String slots are still zero until bin_emit(), so the fixed part compares as bytes. */
+static bool
+bin_record_eq(const IPCBinRecord *a, const IPCBinRecord *b)
+{
+	int i;
+
+	if (memcmp(&a->u, &b->u, a->u.rec.size))
+		return false;
+	for (i = 0; i < a->nstrings; i++) {
+		if (!model_str_eq(a->strings[i], b->strings[i]))
+			return false;
+	}
+	return true;
+}
+
+static void
+bin_frame_begin(void)
+{
+	json_buf_reset(&ipc_server.records);
+	json_buf_reset(&ipc_server.strings);
+	ipc_server.nrecords = 0;
+}
+
+static void
+bin_emit(IPCBinRecord *r)
+{
+	struct VwlIpcString *slot = (struct VwlIpcString *)(void *)((char *)&r->u + r->u.rec.size) - r->nstrings;
+	int i;
+
+	for (i = 0; i < r->nstrings; i++) {
+		slot[i].offset = (uint32_t)ipc_server.strings.len;
+		slot[i].len = r->strings[i] ? (uint32_t)strlen(r->strings[i]) : VWL_IPC_NULL;
+		if (r->strings[i])
+			json_write(&ipc_server.strings, r->strings[i], slot[i].len);
+	}
+	json_write(&ipc_server.records, (const char *)&r->u, r->u.rec.size);
+	ipc_server.nrecords++;
+}
+
+static void
+bin_emit_changed(IPCBinRecord *old, IPCBinRecord *cur)
+{
+	if (!bin_record_eq(old, cur))
+		bin_emit(cur);
+}
+
+/* Header, records and string area of the frame built since bin_frame_begin(). */
+static void
+bin_frame_finish(JsonBuf *out, enum VwlIpcFrameType type)
+{
+	struct VwlIpcFrame frame = {
+			.size = (uint32_t)(sizeof(frame) + ipc_server.records.len + ipc_server.strings.len),
+			.type = (uint16_t)type,
+			.count = (uint16_t)ipc_server.nrecords,
+			.strings = (uint32_t)(sizeof(frame) + ipc_server.records.len),
+	};
+
+	json_buf_reset(out);
+	json_write(out, (const char *)&frame, sizeof(frame));
+	json_write(out, ipc_server.records.data, ipc_server.records.len);
+	json_write(out, ipc_server.strings.data, ipc_server.strings.len);
+}
+
+/* The binary counterpart of json_write_snapshot(). */
+static void
+bin_write_state(const IPCModel *model, unsigned int topics)
+{
+	IPCBinRecord r;
+	size_t i;
+
+	if (topics & IPC_TOPIC_FOCUS) {
+		bin_focus(&r, model);
+		bin_emit(&r);
+	}
+	if (topics & IPC_TOPIC_POINTER) {
+		bin_pointer(&r, model);
+		bin_emit(&r);
+	}
+	for (i = 0; i < model->noutputs; i++) {
+		if (topics & IPC_TOPIC_OUTPUTS) {
+			bin_output(&r, model, i);
+			bin_emit(&r);
+		}
+		if (topics & IPC_TOPIC_WINDOWS) {
+			bin_window(&r, model, i);
+			bin_emit(&r);
+		}
+	}
+	for (i = 0; (topics & IPC_TOPIC_OUTPUTS) && i < model->nvouts; i++) {
+		bin_vout(&r, &model->vouts[i]);
+		bin_emit(&r);
+	}
+	for (i = 0; (topics & IPC_TOPIC_WORKSPACES) && i < WORKSPACE_COUNT; i++) {
+		if (!model->workspaces[i].listed)
+			continue;
+		bin_workspace(&r, model, (unsigned int)i);
+		bin_emit(&r);
+	}
+}
+
+/*
+ * The binary counterpart of build_deltas(): an event frame holding every record
+ * that differs between the two models, or NULL if none does. Records compare
+ * whole, so a change to any field resends the record.
+ */
+static const char *
+build_frame_deltas(JsonBuf *out, const IPCModel *old, const IPCModel *cur, unsigned int topics, size_t *len)
+{
+	IPCBinRecord a, b;
+	const IPCVoutModel *vm;
+	size_t i;
+
+	bin_frame_begin();
+	if (topics & IPC_TOPIC_FOCUS) {
+		bin_focus(&a, old);
+		bin_focus(&b, cur);
+		bin_emit_changed(&a, &b);
+	}
+	if (topics & IPC_TOPIC_POINTER) {
+		bin_pointer(&a, old);
+		bin_pointer(&b, cur);
+		bin_emit_changed(&a, &b);
+	}
+	for (i = 0; i < cur->noutputs; i++) {
+		if (topics & IPC_TOPIC_OUTPUTS) {
+			bin_output(&a, old, i);
+			bin_output(&b, cur, i);
+			bin_emit_changed(&a, &b);
+		}
+		if (topics & IPC_TOPIC_WINDOWS) {
+			bin_window(&a, old, i);
+			bin_window(&b, cur, i);
+			bin_emit_changed(&a, &b);
+		}
+	}
+	for (i = 0; (topics & IPC_TOPIC_OUTPUTS) && i < old->nvouts; i++) {
+		if (model_find_vout(cur, old->vouts[i].id))
+			continue;
+		bin_vout(&a, &old->vouts[i]);
+		a.u.vout.removed = 1;
+		bin_emit(&a);
+	}
+	for (i = 0; (topics & IPC_TOPIC_OUTPUTS) && i < cur->nvouts; i++) {
+		bin_vout(&b, &cur->vouts[i]);
+		if (!(vm = model_find_vout(old, cur->vouts[i].id))) {
+			bin_emit(&b);
+			continue;
+		}
+		bin_vout(&a, vm);
+		bin_emit_changed(&a, &b);
+	}
+	for (i = 0; (topics & IPC_TOPIC_WORKSPACES) && i < WORKSPACE_COUNT; i++) {
+		if (!old->workspaces[i].listed && !cur->workspaces[i].listed)
+			continue;
+		if (!cur->workspaces[i].listed) {
+			bin_workspace(&a, old, (unsigned int)i);
+			a.u.workspace.removed = 1;
+			bin_emit(&a);
+			continue;
+		}
+		bin_workspace(&b, cur, (unsigned int)i);
+		if (!old->workspaces[i].listed) {
+			bin_emit(&b);
+			continue;
+		}
+		bin_workspace(&a, old, (unsigned int)i);
+		bin_emit_changed(&a, &b);
+	}
+
+	if (!ipc_server.nrecords)
+		return NULL;
+	bin_frame_finish(out, VWL_IPC_FRAME_EVENT);
+	*len = out->len;
+	return out->data;
+}
+
+/* Binary state frame for a topic set, built once per model like model_snapshot(). */
+static const char *
+model_state_frame(IPCModel *model, unsigned int topics, size_t *len)
+{
+	if (!model->frames[topics]) {
+		bin_frame_begin();
+		bin_write_state(model, topics);
+		bin_frame_finish(&ipc_server.scratch, VWL_IPC_FRAME_STATE);
+		model->frames[topics] = json_buf_dup(&ipc_server.scratch);
+		model->frame_lens[topics] = ipc_server.scratch.len;
+	}
+	*len = model->frame_lens[topics];
+	return model->frames[topics];
+}
+
+/* Returns a reference to the model of the current state generation. */
+static IPCModel *
+ipc_model_current(void)
+{
+	if (!ipc_server.current || ipc_server.current->generation != ipc_server.generation) {
+		ipc_model_unref(ipc_server.current);
+		ipc_server.current = ipc_model_capture();
+		ipc_server.current->generation = ipc_server.generation;
+	}
+	ipc_server.current->refs++;
+	return ipc_server.current;
+}
+
+/*
+ * Remembers a model whose seq subscribers have seen, so they can resume from it
+ * with since_seq. Only the newest keeps its serialized forms; diffing needs just
+ * the model itself.
+ */
+static void
+ipc_history_add(IPCModel *model)
+{
+	size_t cap = ipc_config()->history;
+	IPCModel *newest;
+
+	if (!cap)
+		return;
+	if (!ipc_server.history)
+		ipc_server.history = ecalloc(cap, sizeof(*ipc_server.history));
+	if (ipc_server.history_len) {
+		newest = ipc_server.history[(ipc_server.history_head + ipc_server.history_len - 1) % cap];
+		if (newest == model)
+			return;
+		ipc_model_drop_serialized(newest);
+	}
+	if (ipc_server.history_len == cap) {
+		ipc_model_unref(ipc_server.history[ipc_server.history_head]);
+		ipc_server.history_head = (ipc_server.history_head + 1) % cap;
+		ipc_server.history_len--;
+	}
+	model->refs++;
+	ipc_server.history[(ipc_server.history_head + ipc_server.history_len++) % cap] = model;
+}
+
+/* The remembered model with the given seq, or NULL if it has left the ring. */
+static IPCModel *
+ipc_history_find(unsigned long seq)
+{
+	size_t cap = ipc_config()->history;
+	size_t i;
+
+	for (i = 0; i < ipc_server.history_len; i++) {
+		IPCModel *model = ipc_server.history[(ipc_server.history_head + i) % cap];
+
+		if (model->generation == seq)
+			return model;
+	}
+	return NULL;
+}
+
+/* Sends what fits of iov, with pass_fd attached unless it is -1. */
+static ssize_t
+ipc_sendv(int fd, const struct iovec *iov, int iovcnt, int pass_fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg = {
+			.msg_iov = (struct iovec *)iov,
+			.msg_iovlen = (size_t)iovcnt,
+	};
+	struct cmsghdr *cmsg;
+	ssize_t n;
+
+	if (pass_fd >= 0) {
+		memset(&control, 0, sizeof(control));
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+	}
+	do {
+		n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+	return n;
+}
+
+static void
+ipc_client_drop_message(IPCClient *client, IPCMessage *msg)
+{
+	client->queued -= msg->len;
+	wl_list_remove(&msg->link);
+	free(msg);
+}
+
+/* Drop queued state events, oldest first, until `need` more bytes fit. A
+ * partially sent message is kept so the stream stays message-aligned. */
+static void
+ipc_client_drop_events(IPCClient *client, size_t need)
+{
+	IPCMessage *msg, *tmp;
+
+	wl_list_for_each_safe(msg, tmp, &client->outq, link) {
+		if (client->queued + need <= ipc_config()->outbound_limit)
+			break;
+		if (!msg->event || (msg->link.prev == &client->outq && client->head_sent))
+			continue;
+		ipc_client_drop_message(client, msg);
+		ipc_server.dropped_events++;
+		if (client->subscribed == IPC_SUB_DELTA)
+			client->resync = true;
+		if (client->geom_watch)
+			client->geom_resync = ipc_server.geom_resync = true;
+	}
+}
+
+static int
+ipc_client_flush(IPCClient *client)
+{
+	struct iovec iov[IPC_FLUSH_IOV];
+	IPCMessage *msg, *tmp;
+	ssize_t n;
+	size_t sent;
+	int count, pass_fd;
+
+	while (!wl_list_empty(&client->outq)) {
+		count = 0;
+		msg = wl_container_of(client->outq.next, msg, link);
+		pass_fd = client->head_sent ? -1 : msg->fd;
+		wl_list_for_each(msg, &client->outq, link) {
+			/* a message carrying an fd starts a send of its own */
+			if (count == IPC_FLUSH_IOV || (count && msg->fd >= 0))
+				break;
+			iov[count].iov_base = msg->data + (count ? 0 : client->head_sent);
+			iov[count].iov_len = msg->len - (count ? 0 : client->head_sent);
+			count++;
+		}
+
+		n = ipc_sendv(client->fd, iov, count, pass_fd);
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+
+		sent = (size_t)n + client->head_sent;
+		client->head_sent = 0;
+		wl_list_for_each_safe(msg, tmp, &client->outq, link) {
+			if (sent < msg->len) {
+				client->head_sent = sent;
+				break;
+			}
+			sent -= msg->len;
+			ipc_client_drop_message(client, msg);
+		}
+	}
+
+	if (client->eof && !client->subscribed && !client->geom_watch && !client->nwaits &&
+			wl_list_empty(&client->outq))
+		return -1;
+	return wl_event_source_fd_update(client->source, (client->eof ? 0 : WL_EVENT_READABLE) | WL_EVENT_ERROR |
+			WL_EVENT_HANGUP | (wl_list_empty(&client->outq) ? 0 : WL_EVENT_WRITABLE));
+}
+
+/* Queue one message, gathered from iov, for the client and try to send it right
+ * away, passing pass_fd along unless it is -1. Returns -1 if the client has to be
+ * disconnected. */
+static int
+ipc_send(IPCClient *client, const struct iovec *iov, int iovcnt, bool event, int pass_fd)
+{
+	size_t len = 0;
+	size_t sent = 0;
+	bool empty = wl_list_empty(&client->outq);
+	IPCMessage *msg;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (empty) {
+		ssize_t n = ipc_sendv(client->fd, iov, iovcnt, pass_fd);
+
+		if (n < 0)
+			return -1;
+		if ((size_t)n == len) {
+			ipc_server.sent_bytes[event] += len;
+			return 0;
+		}
+		sent = (size_t)n;
+	}
+
+	/* an empty queue always takes the message, however long */
+	if (!empty && client->queued + len > ipc_config()->outbound_limit) {
+		if (ipc_config()->slow_policy == IPC_SLOW_DISCONNECT) {
+			ipc_server.dropped_clients++;
+			return -1;
+		}
+		ipc_client_drop_events(client, len);
+		if (client->queued + len > ipc_config()->outbound_limit) {
+			/* nothing left to drop; an event that does not fit is dropped itself */
+			if (!event) {
+				ipc_server.dropped_clients++;
+				return -1;
+			}
+			ipc_server.dropped_events++;
+			if (client->subscribed == IPC_SUB_DELTA)
+				client->resync = true;
+			if (client->geom_watch)
+				client->geom_resync = ipc_server.geom_resync = true;
+			return 0;
+		}
+	}
+
+	msg = malloc(sizeof(*msg) + len);
+	if (!msg)
+		return -1;
+	msg->event = event;
+	msg->fd = sent ? -1 : pass_fd;
+	msg->len = 0;
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(msg->data + msg->len, iov[i].iov_base, iov[i].iov_len);
+		msg->len += iov[i].iov_len;
+	}
+	wl_list_insert(client->outq.prev, &msg->link);
+	client->queued += msg->len;
+	ipc_server.sent_bytes[event] += msg->len;
+	if (sent) {
+		client->head_sent = sent;
+		return ipc_client_flush(client);
+	}
+	return wl_event_source_fd_update(client->source, (client->eof ? 0 : WL_EVENT_READABLE) | WL_EVENT_ERROR |
+			WL_EVENT_HANGUP | WL_EVENT_WRITABLE);
+}
+
+/* Sends one JSON line, or a reply frame carrying it once the client went binary. */
+static int
+ipc_send_line_fd(IPCClient *client, const char *line, bool event, int pass_fd)
+{
+	size_t len = strlen(line);
+	struct VwlIpcFrame frame = {
+			.size = (uint32_t)(sizeof(frame) + len),
+			.type = VWL_IPC_FRAME_REPLY,
+			.strings = (uint32_t)sizeof(frame),
+	};
+	struct iovec iov[2] = {
+			{.iov_base = (void *)line, .iov_len = len},
+			{.iov_base = "\n", .iov_len = 1},
+	};
+
+	if (client->binary) {
+		iov[1] = iov[0];
+		iov[0] = (struct iovec){.iov_base = &frame, .iov_len = sizeof(frame)};
+	}
+	return ipc_send(client, iov, 2, event, pass_fd);
+}
+
+static int
+ipc_send_line(IPCClient *client, const char *line, bool event)
+{
+	return ipc_send_line_fd(client, line, event, -1);
+}
+
+static int
+ipc_send_frame(IPCClient *client, const char *frame, size_t len, bool event)
+{
+	struct iovec iov = {.iov_base = (void *)frame, .iov_len = len};
+
+	return ipc_send(client, &iov, 1, event, -1);
+}
+
+/* Full state of the client's topics, as a state event or a state frame. */
+static int
+ipc_send_state(IPCClient *client, IPCModel *model, bool event)
+{
+	const char *frame;
+	size_t len;
+
+	if (!client->binary)
+		return ipc_send_line(client, model_state_event(model, client->topics, client->view), event);
+	frame = model_state_frame(model, client->topics, &len);
+	return ipc_send_frame(client, frame, len, event);
+}
+
+static long
+ipc_ms_since(const struct timespec *t)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long)(now.tv_sec - t->tv_sec) * 1000 + (now.tv_nsec - t->tv_nsec) / 1000000;
+}
+
+/* Forget the publishes held back from a rate limited subscriber, as it is sent a state now. */
+static void
+ipc_client_rate_reset(IPCClient *client)
+{
+	ipc_model_unref(client->rate_base);
+	client->rate_base = NULL;
+	if (client->rate_timer)
+		wl_event_source_timer_update(client->rate_timer, 0);
+	clock_gettime(CLOCK_MONOTONIC, &client->rate_sent);
+}
+
+/* Take a subscriber off the fan-out list, as it is sent the last publish some other way. */
+static void
+ipc_fanout_drop(IPCClient *client)
+{
+	wl_list_remove(&client->fanout_link);
+	wl_list_init(&client->fanout_link);
+	ipc_model_unref(client->fanout_base);
+	client->fanout_base = NULL;
+}
+
+/* Replace whatever state events a lagging delta subscriber still has queued
+ * with one full state event built from the state its stream has reached. */
+static int
+ipc_client_resync(IPCClient *client, IPCModel *model)
+{
+	IPCMessage *msg, *tmp;
+
+	wl_list_for_each_safe(msg, tmp, &client->outq, link) {
+		if (msg->event && !(msg->link.prev == &client->outq && client->head_sent)) {
+			ipc_client_drop_message(client, msg);
+			ipc_server.dropped_events++;
+		}
+	}
+	/* the state sent below covers the publish being fanned out and any held back */
+	if (model == ipc_server.last) {
+		ipc_fanout_drop(client);
+		ipc_client_rate_reset(client);
+	}
+	client->resync = false;
+	if (ipc_send_state(client, model, true) < 0 || client->resync)
+		return -1;
+	return 0;
+}
+
+static int
+ipc_send_or_drop(IPCClient *client, const char *line)
+{
+	if (ipc_send_line(client, line, false) < 0 ||
+			(client->resync && ipc_client_resync(client, ipc_server.last) < 0)) {
+		ipc_client_destroy(client);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Timer of a rate limited subscriber: sends the publishes it was held back from
+ * as one, going from the state it had reached straight to the last published one.
+ */
+static int
+ipc_client_rate_flush(void *data)
+{
+	IPCClient *client = data;
+	IPCModel *base = client->rate_base;
+	IPCModel *model = ipc_server.last;
+	const char *deltas = NULL;
+	size_t len = 0;
+	int ret = 0;
+
+	client->rate_base = NULL;
+	clock_gettime(CLOCK_MONOTONIC, &client->rate_sent);
+	if (!base || !model) {
+		ipc_model_unref(base);
+		return 0;
+	}
+	/* this covers the publish being fanned out too */
+	ipc_fanout_drop(client);
+	if (client->subscribed == IPC_SUB_DELTA && model_outputs_match(base, model)) {
+		if (base != model && client->binary)
+			deltas = build_frame_deltas(&ipc_server.scratch, base, model, client->topics, &len);
+		else if (base != model)
+			deltas = build_deltas(&ipc_server.scratch, base, model, client->topics);
+		if (deltas && client->binary)
+			ret = ipc_send_frame(client, deltas, len, true);
+		else if (deltas)
+			ret = ipc_send_line(client, deltas, true);
+	} else {
+		ret = ipc_send_state(client, model, true);
+	}
+	ipc_model_unref(base);
+	if (ret < 0 || (client->resync && ipc_client_resync(client, model) < 0))
+		ipc_client_destroy(client);
+	return 0;
+}
+
+/*
+ * Holds a publish back from a rate limited subscriber that was sent a state too
+ * recently; its timer sends the latest state once the interval is up, however
+ * many publishes were held back meanwhile. `base` is the state the publish
+ * starts from. Returns whether the publish was held back.
+ */
+static bool
+ipc_client_rate_hold(IPCClient *client, IPCModel *base)
+{
+	long wait;
+
+	if (!client->max_hz)
+		return false;
+	if (client->rate_base)
+		return true;
+	wait = 1000 / client->max_hz - ipc_ms_since(&client->rate_sent);
+	if (wait > 0 && !client->rate_timer)
+		client->rate_timer = wl_event_loop_add_timer(event_loop, ipc_client_rate_flush, client);
+	if (wait <= 0 || !client->rate_timer || !base) {
+		clock_gettime(CLOCK_MONOTONIC, &client->rate_sent);
+		return false;
+	}
+	base->refs++;
+	client->rate_base = base;
+	wl_event_source_timer_update(client->rate_timer, (int)wait);
+	return true;
+}
+
+/*
+ * Replies with the state of the given topics and view and drops the model
+ * reference. Binary clients get a plain reply followed by a state frame.
+ */
+static int
+ipc_reply_state(IPCClient *client, int id, IPCModel *model, unsigned int topics, unsigned int view)
+{
+	const char *reply, *frame;
+	size_t len;
+	int ret;
+
+	if (!client->binary) {
+		reply = build_state_reply(id, model->generation, model_snapshot(model, topics, view));
+		ipc_model_unref(model);
+		return ipc_send_or_drop(client, reply);
+	}
+	frame = model_state_frame(model, topics, &len);
+	ret = ipc_send_or_drop(client, build_ok_reply(id));
+	if (!ret && ipc_send_frame(client, frame, len, false) < 0) {
+		ipc_client_destroy(client);
+		ret = -1;
+	}
+	ipc_model_unref(model);
+	return ret;
+}
+
+/*
+ * Answers a delta subscription that resumes from since_seq with the delta events
+ * between the remembered state and the model, and drops the model reference.
+ * Falls back to a full state reply if that state has left the history or the
+ * outputs changed in between.
+ */
+static int
+ipc_reply_resume(IPCClient *client, int id, IPCModel *model, unsigned long since_seq)
+{
+	IPCModel *old = ipc_history_find(since_seq);
+	const char *deltas;
+	JsonBuf *buf;
+	int ret = 0;
+
+	if (!old || !model_outputs_match(old, model))
+		return ipc_reply_state(client, id, model, client->topics, client->view);
+
+	buf = reply_begin(id, true);
+	json_write_str(buf, ",\"seq\":");
+	json_write_uint(buf, model->generation);
+	json_write_str(buf, ",\"resumed\":true}");
+	if (ipc_send_or_drop(client, json_buf_str(buf)) < 0) {
+		ipc_model_unref(model);
+		return -1;
+	}
+	deltas = old != model ? build_deltas(&ipc_server.scratch, old, model, client->topics) : NULL;
+	if (deltas)
+		ret = ipc_send_line(client, deltas, true);
+	if (ret < 0 || (client->resync && ipc_client_resync(client, model) < 0)) {
+		ipc_client_destroy(client);
+		ret = -1;
+	}
+	ipc_model_unref(model);
+	return ret;
+}
+
+/* the page holds every workspace, indexed by id like workspaces[] */
+_Static_assert(VWL_IPC_SHM_WORKSPACES == WORKSPACE_COUNT, "VWL_IPC_SHM_WORKSPACES must match WORKSPACE_COUNT");
+
+static void
+shm_copy_name(char *out, const char *name)
+{
+	snprintf(out, VWL_IPC_SHM_NAME_LEN, "%s", name ? name : "");
+}
+
+/* Rewrites the state page from the model; the seqlock keeps readers from using a torn copy. */
+static void
+ipc_shm_write(const IPCModel *model)
+{
+	struct VwlIpcShmState *page = ipc_server.shm;
+	size_t i;
+
+	__atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	page->generation = model->generation;
+	page->focused_output = model->focused_output;
+	page->focused_vout = model->focused_vout;
+	page->focused_workspace = model->focused_workspace;
+	page->pointer_output = model->pointer_output;
+	page->reveal_hover = model->reveal_hover;
+	page->reveal_edge = (uint8_t)(pointer_reveal_edge_name(model->reveal_edge) ? model->reveal_edge : 0);
+
+	memset(page->outputs, 0, sizeof(page->outputs));
+	page->noutputs = (uint32_t)MIN(model->noutputs, LENGTH(page->outputs));
+	for (i = 0; i < page->noutputs; i++) {
+		const IPCOutputModel *out = &model->outputs[i];
+		struct VwlIpcShmOutput *so = &page->outputs[i];
+
+		shm_copy_name(so->name, out->name);
+		bin_box(&so->geometry, &out->geometry);
+		bin_box(&so->workarea, &out->workarea);
+		so->active_vout = out->active_vout;
+		so->focused = out->focused;
+	}
+
+	memset(page->vouts, 0, sizeof(page->vouts));
+	page->nvouts = (uint32_t)MIN(model->nvouts, LENGTH(page->vouts));
+	for (i = 0; i < page->nvouts; i++) {
+		const IPCVoutModel *vm = &model->vouts[i];
+		struct VwlIpcShmVout *sv = &page->vouts[i];
+
+		shm_copy_name(sv->name, vm->name);
+		sv->id = vm->id;
+		sv->output = vm->output;
+		sv->workspace = vm->workspace;
+		sv->clients = vm->clients;
+		bin_box(&sv->geometry, &vm->geometry);
+		sv->focused = vm->focused;
+		sv->urgent = vm->urgent;
+	}
+
+	memset(page->workspaces, 0, sizeof(page->workspaces));
+	for (i = 0; i < WORKSPACE_COUNT; i++) {
+		const IPCWorkspaceModel *wm = &model->workspaces[i];
+		struct VwlIpcShmWorkspace *sw = &page->workspaces[i];
+
+		if (!wm->listed)
+			continue;
+		shm_copy_name(sw->name, wm->name);
+		sw->output = wm->output;
+		sw->vout = wm->vout;
+		sw->clients = wm->clients;
+		sw->listed = 1;
+		sw->assigned = wm->assigned;
+		sw->visible = wm->visible;
+		sw->focused = wm->focused;
+		sw->urgent = wm->urgent;
+	}
+
+	__atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELEASE);
+	ipc_server.shm_generation = model->generation;
+}
+
+/* Brings the state page, if anyone asked for it, up to the current generation. */
+static void
+ipc_shm_update(void)
+{
+	IPCModel *model;
+
+	if (!ipc_server.shm || ipc_server.shm_generation == ipc_server.generation)
+		return;
+	model = ipc_model_current();
+	ipc_shm_write(model);
+	ipc_model_unref(model);
+}
+
+/*
+ * Creates the state page on first use. Once mapped writable here, the memfd is
+ * sealed so that every other mapping of it, and so every client's, is read-only.
+ */
+static int
+ipc_shm_create(void)
+{
+	IPCModel *model;
+	void *page;
+	int fd;
+
+	if (ipc_server.shm)
+		return 0;
+	fd = memfd_create("vwl-ipc-state", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, sizeof(*ipc_server.shm)) < 0)
+		goto err;
+	page = mmap(NULL, sizeof(*ipc_server.shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (page == MAP_FAILED)
+		goto err;
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+		munmap(page, sizeof(*ipc_server.shm));
+		goto err;
+	}
+
+	ipc_server.shm = page;
+	ipc_server.shm_fd = fd;
+	ipc_server.shm->magic = VWL_IPC_SHM_MAGIC;
+	ipc_server.shm->version = VWL_IPC_SHM_VERSION;
+	ipc_server.shm->size = sizeof(*ipc_server.shm);
+	model = ipc_model_current();
+	ipc_shm_write(model);
+	ipc_model_unref(model);
+	return 0;
+
+err:
+	close(fd);
+	return -1;
+}
+
+static VirtualOutput *
+resolve_vout(const IPCRequest *req, const char **error)
+{
+	Monitor *m;
+	VirtualOutput *vout;
+
+	if (req->got_vout_id > 0) {
+		vout = voutbyid((unsigned int)req->vout_id);
+		if (!vout)
+			*error = "unknown virtual output";
+		return vout;
+	}
+
+	if (req->got_vout_name <= 0) {
+		*error = "missing virtual output reference";
+		return NULL;
+	}
+
+	if (req->got_output <= 0) {
+		*error = "missing output for named virtual output";
+		return NULL;
+	}
+
+	m = monitorbyname(req->output);
+	if (!m) {
+		*error = "unknown output";
+		return NULL;
+	}
+
+	if (!(vout = findvoutbyname(m, req->vout_name))) {
+		*error = "unknown virtual output";
+		return NULL;
+	}
+
+	return vout;
+}
+
+/* The window a request names by client_id, or NULL with *error set. */
+static Client *
+resolve_client(const IPCRequest *req, const char **error)
+{
+	Client *c;
+
+	if (req->got_client_id <= 0) {
+		*error = req->got_client_id < 0 ? "invalid client_id" : "missing client_id";
+		return NULL;
+	}
+	if (!(c = clientbyid(req->client_id))) {
+		*error = "unknown client";
+		return NULL;
+	}
+	return c;
+}
+
+/*
+ * Runs one of the requests that change compositor state. Returns 0 on success,
+ * -1 with *error set if it failed, and 1 if req is not such a command.
+ */
+static int
+run_command(const IPCRequest *req, const char **error)
+{
+	const char *type = req->type;
+	VirtualOutput *vout;
+	Workspace *ws;
+	Client *c;
+
+	if (!strcmp(type, "set_workspace")) {
+		if (req->got_workspace_id <= 0) {
+			*error = "missing workspace_id";
+			return -1;
+		}
+		if (ipc_set_workspace_by_id((unsigned int)req->workspace_id) < 0) {
+			*error = "unknown workspace";
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!strcmp(type, "set_vout_focus")) {
+		if (!(vout = resolve_vout(req, error)))
+			return -1;
+		if (ipc_focus_virtual_output(vout) < 0) {
+			*error = "failed to focus virtual output";
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!strcmp(type, "move_workspace_to_vout")) {
+		if (req->got_workspace_id <= 0) {
+			*error = "missing workspace_id";
+			return -1;
+		}
+		ws = wsbyid((unsigned int)req->workspace_id);
+		if (!ws) {
+			*error = "unknown workspace";
+			return -1;
+		}
+		if (!(vout = resolve_vout(req, error)))
+			return -1;
+		if (ipc_move_workspace_to_vout(ws, vout) < 0) {
+			*error = "failed to move workspace";
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!strcmp(type, "focus_client")) {
+		if (!(c = resolve_client(req, error)))
+			return -1;
+		if (ipc_focus_client(c) < 0) {
+			*error = "failed to focus client";
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!strcmp(type, "move_client_to_workspace")) {
+		if (!(c = resolve_client(req, error)))
+			return -1;
+		if (req->got_workspace_id <= 0) {
+			*error = "missing workspace_id";
+			return -1;
+		}
+		if (!(ws = wsbyid((unsigned int)req->workspace_id))) {
+			*error = "unknown workspace";
+			return -1;
+		}
+		if (ipc_move_client_to_workspace(c, ws) < 0) {
+			*error = "failed to move client";
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!strcmp(type, "close_client")) {
+		if (!(c = resolve_client(req, error)))
+			return -1;
+		if (ipc_close_client(c) < 0) {
+			*error = "failed to close client";
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!strcmp(type, "spawn_on_workspace")) {
+		if (req->got_workspace_id <= 0) {
+			*error = "missing workspace_id";
+			return -1;
+		}
+		if (req->got_command <= 0 || !req->command[0]) {
+			*error = "missing command";
+			return -1;
+		}
+		if (ipc_spawn_on_workspace((unsigned int)req->workspace_id, req->command) < 0) {
+			*error = "failed to spawn on workspace";
+			return -1;
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Runs every command of a batch in order inside ipc_batch_begin()/end(), so
+ * relayout, focus, cursor warp and the state publish happen once at the end
+ * rather than after each command. [p, end) is the already validated array.
+ */
+static const char *
+run_batch(int id, const char *p, const char *end)
+{
+	JsonBuf *results = &ipc_server.results;
+	IPCRequest cmd;
+	const char *error;
+	JsonBuf *buf;
+	int n = 0;
+
+	json_buf_reset(results);
+	ipc_batch_begin();
+	for (p = json_skip_ws(p + 1, end); p < end && *p != ']'; p = json_skip_ws(p + 1, end)) {
+		const char *next = parse_request(&cmd, p, end);
+
+		error = NULL;
+		if (!next) {
+			error = "malformed command";
+			next = json_skip_value(p, end);
+		} else if (cmd.got_type <= 0) {
+			error = "missing request type";
+		} else if (run_command(&cmd, &error) > 0) {
+			error = "not allowed in batch";
+		}
+
+		json_write_str(results, n++ ? ",{\"ok\":" : "{\"ok\":");
+		json_write_bool(results, !error);
+		if (error) {
+			json_write_str(results, ",\"error\":");
+			json_write_escaped(results, error);
+		}
+		json_write_char(results, '}');
+		p = json_skip_ws(next, end);
+		if (*p != ',')
+			break;
+	}
+	ipc_batch_end();
+
+	buf = reply_begin(id, true);
+	json_write_str(buf, ",\"results\":[");
+	json_write(buf, results->data, results->len);
+	json_write_str(buf, "]}");
+	return json_buf_str(buf);
+}
+
+static const char *
+build_wait_reply(int id, Client *c)
+{
+	JsonBuf *buf = reply_begin(id, true);
+
+	if (c) {
+		json_write_str(buf, ",\"client_id\":");
+		json_write_uint(buf, c->id);
+	}
+	json_write_char(buf, '}');
+	return json_buf_str(buf);
+}
+
+static bool
+wait_app_matches(const IPCWait *w, Client *c)
+{
+	return !client_is_unmanaged(c) && !strcmp(client_get_appid(c), w->app_id);
+}
+
+/* Whether a workspace_visible or output_present wait is met by the current state. */
+static bool
+wait_state_met(const IPCWait *w)
+{
+	Workspace *ws;
+	VirtualOutput *vout;
+
+	if (w->condition == IPC_WAIT_OUTPUT_PRESENT)
+		return monitorbyname(w->output) != NULL;
+	if (!(ws = wsbyid(w->workspace_id)) || !(vout = ws->vout) || vout->ws != ws)
+		return false;
+	if (w->vout_id)
+		return vout->id == w->vout_id;
+	if (w->vout_name[0])
+		return vout->mon == monitorbyname(w->output) && !strcmp(vout->name, w->vout_name);
+	return true;
+}
+
+static void
+ipc_wait_destroy(IPCWait *w)
+{
+	wl_list_remove(&w->link);
+	if (w->timer)
+		wl_event_source_remove(w->timer);
+	w->client->nwaits--;
+	free(w);
+}
+
+/*
+ * Answers a wait with line and forgets it, closing a client that is done
+ * sending once nothing else is pending. Returns -1 if the client is gone.
+ */
+static int
+ipc_wait_reply(IPCWait *w, const char *line)
+{
+	IPCClient *client = w->client;
+
+	ipc_wait_destroy(w);
+	if (ipc_send_or_drop(client, line) < 0)
+		return -1;
+	if (client->eof && !client->nwaits && ipc_client_flush(client) < 0) {
+		ipc_client_destroy(client);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+ipc_wait_timeout(void *data)
+{
+	IPCWait *w = data;
+
+	ipc_wait_reply(w, build_error_reply(w->id, "timeout"));
+	return 0;
+}
+
+/*
+ * The oldest wait that is met: with c, an app_mapped wait for that newly
+ * mapped window; without, any other wait. Waits are looked up afresh after
+ * each reply because answering one can disconnect a client with more.
+ */
+static IPCWait *
+ipc_wait_next(Client *c)
+{
+	IPCWait *w;
+
+	wl_list_for_each(w, &ipc_server.waits, link) {
+		if (c && w->condition == IPC_WAIT_APP_MAPPED && wait_app_matches(w, c))
+			return w;
+		if (!c && w->condition != IPC_WAIT_APP_MAPPED && wait_state_met(w))
+			return w;
+	}
+	return NULL;
+}
+
+/* Answers the waits the state now meets; a no-op until the generation moves on. */
+static void
+ipc_wait_check(void)
+{
+	IPCWait *w;
+
+	if (ipc_server.wait_generation == ipc_server.generation)
+		return;
+	ipc_server.wait_generation = ipc_server.generation;
+	while ((w = ipc_wait_next(NULL)))
+		ipc_wait_reply(w, build_ok_reply(w->id));
+}
+
+/*
+ * Handles a wait request: answers right away if the condition already holds,
+ * otherwise keeps it until mapnotify() or a publish finds it met, or until
+ * timeout_ms runs out. Returns -1 if the client was disconnected.
+ */
+static int
+ipc_wait_add(IPCClient *client, int id, const IPCRequest *req)
+{
+	const char *error = NULL;
+	IPCWait *w;
+	Client *c;
+	size_t i;
+
+	for (i = 0; i < LENGTH(ipc_wait_names); i++) {
+		if (req->got_condition > 0 && !strcmp(req->condition, ipc_wait_names[i]))
+			break;
+	}
+	if (i == LENGTH(ipc_wait_names))
+		return ipc_send_or_drop(client, build_error_reply(id, "unknown condition"));
+	if (req->got_timeout_ms < 0 || (req->got_timeout_ms > 0 && req->timeout_ms < 1))
+		return ipc_send_or_drop(client, build_error_reply(id, "invalid timeout_ms"));
+	if (client->nwaits >= IPC_CLIENT_WAITS)
+		return ipc_send_or_drop(client, build_error_reply(id, "too many waits"));
+
+	switch (i) {
+	case IPC_WAIT_APP_MAPPED:
+		if (req->got_app_id <= 0)
+			error = req->got_app_id < 0 ? "invalid app_id" : "missing app_id";
+		break;
+	case IPC_WAIT_WORKSPACE_VISIBLE:
+		if (req->got_workspace_id <= 0)
+			error = "missing workspace_id";
+		else if (!wsbyid((unsigned int)req->workspace_id))
+			error = "unknown workspace";
+		else if (req->got_vout_id < 0 || (req->got_vout_id > 0 && req->vout_id < 1))
+			error = "invalid vout_id";
+		else if (req->got_vout_name > 0 && req->got_output <= 0)
+			error = "missing output for named virtual output";
+		break;
+	case IPC_WAIT_OUTPUT_PRESENT:
+		if (req->got_output <= 0)
+			error = "missing output";
+		break;
+	}
+	if (error)
+		return ipc_send_or_drop(client, build_error_reply(id, error));
+
+	if (!(w = calloc(1, sizeof(*w))))
+		die("calloc:");
+	w->client = client;
+	w->id = id;
+	w->condition = (int)i;
+	w->workspace_id = (unsigned int)req->workspace_id;
+	/* like resolve_vout(), a vout_id wins over output and vout_name */
+	w->vout_id = req->got_vout_id > 0 ? (unsigned int)req->vout_id : 0;
+	if (req->got_app_id > 0)
+		snprintf(w->app_id, sizeof(w->app_id), "%s", req->app_id);
+	if (req->got_output > 0)
+		snprintf(w->output, sizeof(w->output), "%s", req->output);
+	if (req->got_vout_name > 0 && !w->vout_id)
+		snprintf(w->vout_name, sizeof(w->vout_name), "%s", req->vout_name);
+
+	if (w->condition == IPC_WAIT_APP_MAPPED) {
+		wl_list_for_each(c, &clients, link) {
+			if (wait_app_matches(w, c)) {
+				free(w);
+				return ipc_send_or_drop(client, build_wait_reply(id, c));
+			}
+		}
+	} else if (wait_state_met(w)) {
+		free(w);
+		return ipc_send_or_drop(client, build_ok_reply(id));
+	}
+
+	if (req->got_timeout_ms > 0) {
+		if (!(w->timer = wl_event_loop_add_timer(event_loop, ipc_wait_timeout, w))) {
+			free(w);
+			return ipc_send_or_drop(client, build_error_reply(id, "failed to add timer"));
+		}
+		wl_event_source_timer_update(w->timer, req->timeout_ms);
+	}
+	wl_list_insert(ipc_server.waits.prev, &w->link);
+	client->nwaits++;
+	return 0;
+}
+
+static int
+handle_request(IPCClient *client, const char *line, size_t len)
+{
+	IPCRequest req;
+	const char *type = req.type;
+	int id;
+	const char *error = NULL;
+	const char *end = parse_request(&req, line, line + len);
+	bool first = !client->greeted;
+	unsigned int topics = 0, view = IPC_FIELD_ALL;
+	size_t i;
+
+	/* the publish the client is still owed goes out before any reply to it */
+	if (!wl_list_empty(&client->fanout_link) && ipc_fanout_client(client) < 0)
+		return -1;
+
+	id = req.got_id > 0 ? req.id : 0;
+	if (!end || json_skip_ws(end, line + len) != line + len) {
+		return ipc_send_or_drop(client, build_error_reply(id, "malformed request"));
+	}
+	if (req.got_id < 0) {
+		return ipc_send_or_drop(client, build_error_reply(0, "invalid request id"));
+	}
+
+	if (req.got_type <= 0) {
+		return ipc_send_or_drop(client, build_error_reply(id, "missing request type"));
+	}
+	client->greeted = true;
+
+	if (!strcmp(type, "hello")) {
+		bool binary = req.got_protocol > 0 && !strcmp(req.protocol, "binary");
+
+		if (!first) {
+			return ipc_send_or_drop(client, build_error_reply(id, "hello must be the first request"));
+		}
+		if (req.got_protocol < 0 || (req.got_protocol > 0 && !binary && strcmp(req.protocol, "json"))) {
+			return ipc_send_or_drop(client, build_error_reply(id, "unknown protocol"));
+		}
+		/* the reply itself is still a JSON line */
+		if (ipc_send_or_drop(client, build_hello_reply(id, binary)) < 0)
+			return -1;
+		client->binary = binary;
+		return 0;
+	}
+
+	if (!strcmp(type, "get_state") || !strcmp(type, "subscribe")) {
+		if (req.got_topics < 0) {
+			return ipc_send_or_drop(client, build_error_reply(id, "invalid topics"));
+		}
+		if (req.got_fields < 0) {
+			return ipc_send_or_drop(client, build_error_reply(id, "invalid fields"));
+		}
+		if (req.got_only_populated < 0) {
+			return ipc_send_or_drop(client, build_error_reply(id, "invalid only_populated"));
+		}
+		if (client->binary && (req.got_fields > 0 || req.only_populated)) {
+			return ipc_send_or_drop(client, build_error_reply(id, "fields need the JSON protocol"));
+		}
+		/* fields narrow the topics too, so a subscriber only hears about what it asked for */
+		for (i = 0; i < LENGTH(ipc_field_names); i++) {
+			if (req.fields & (1u << i))
+				topics |= ipc_field_topics[i];
+		}
+		topics &= req.topics;
+		view = req.fields | (req.only_populated ? IPC_VIEW_POPULATED : 0);
+	}
+
+	if (!strcmp(type, "get_state"))
+		return ipc_reply_state(client, id, ipc_model_current(), topics, view);
+
+	if (!strcmp(type, "get_stats"))
+		return ipc_send_or_drop(client, build_stats_reply(id));
+
+	if (!strcmp(type, "get_metrics"))
+		return ipc_send_or_drop(client, build_metrics_reply(id));
+
+	if (!strcmp(type, "get_state_fd")) {
+		if (ipc_shm_create() < 0) {
+			return ipc_send_or_drop(client, build_error_reply(id, "state page unavailable"));
+		}
+		if (ipc_send_line_fd(client, build_state_fd_reply(id), false, ipc_server.shm_fd) < 0) {
+			ipc_client_destroy(client);
+			return -1;
+		}
+		return 0;
 	}
 
 	if (!strcmp(type, "subscribe")) {
-		char *snapshot = build_snapshot();
-		client->subscribed = 1;
-		reply = snapshot ? build_state_reply(id, snapshot) : NULL;
-		free(snapshot);
-		return ipc_send_or_drop(client, reply ? reply : build_error_reply(id, "failed to build state"));
-	}
+		const char *mode = req.mode;
+		int subscribed = IPC_SUB_SNAPSHOT;
+		IPCModel *model;
 
-	if (!strcmp(type, "set_workspace")) {
-		if (json_get_int(line, "workspace_id", &workspace_id) <= 0) {
-			return ipc_send_or_drop(client, build_error_reply(id, "missing workspace_id"));
+		if (req.got_mode < 0 || (req.got_mode > 0 && strcmp(mode, "snapshot") && strcmp(mode, "delta"))) {
+			return ipc_send_or_drop(client, build_error_reply(id, "unknown subscription mode"));
 		}
-		if (ipc_set_workspace_by_id((unsigned int)workspace_id) < 0) {
-			return ipc_send_or_drop(client, build_error_reply(id, "unknown workspace"));
+		if (req.got_mode > 0 && !strcmp(mode, "delta"))
+			subscribed = IPC_SUB_DELTA;
+		if (req.got_since_seq < 0) {
+			return ipc_send_or_drop(client, build_error_reply(id, "invalid since_seq"));
 		}
-		return ipc_send_or_drop(client, build_ok_reply(id));
-	}
-
-	if (!strcmp(type, "set_vout_focus")) {
-		VirtualOutput *vout = resolve_vout(line, &error);
-		if (!vout) {
-			return ipc_send_or_drop(client, build_error_reply(id, error));
+		if (req.got_since_seq > 0 && (subscribed != IPC_SUB_DELTA || client->binary)) {
+			return ipc_send_or_drop(client,
+					build_error_reply(id, "since_seq needs a JSON delta subscription"));
 		}
-		if (ipc_focus_virtual_output(vout) < 0) {
-			return ipc_send_or_drop(client, build_error_reply(id, "failed to focus virtual output"));
+		if (req.got_max_hz < 0 || (req.got_max_hz > 0 && (req.max_hz < 1 || req.max_hz > 1000))) {
+			return ipc_send_or_drop(client, build_error_reply(id, "invalid max_hz"));
 		}
-		return ipc_send_or_drop(client, build_ok_reply(id));
+
+		client->subscribed = IPC_SUB_NONE;
+		if (subscribed == IPC_SUB_DELTA) {
+			/* publish pending changes so the deltas that follow start from the state sent below */
+			ipc_flush();
+			if (!ipc_server.last) {
+				ipc_server.last = ipc_model_current();
+				ipc_history_add(ipc_server.last);
+			}
+			model = ipc_server.last;
+			model->refs++;
+		} else {
+			model = ipc_model_current();
+		}
+		client->subscribed = subscribed;
+		client->topics = topics;
+		client->view = view;
+		client->max_hz = req.got_max_hz > 0 ? req.max_hz : 0;
+		ipc_client_rate_reset(client);
+		if (req.got_since_seq > 0)
+			return ipc_reply_resume(client, id, model, req.since_seq);
+		return ipc_reply_state(client, id, model, topics, view);
 	}
 
-	if (!strcmp(type, "move_workspace_to_vout")) {
-		VirtualOutput *vout;
-		Workspace *ws;
+	if (!strcmp(type, "watch_geometry")) {
+		/* no clients watches every window, an empty list stops watching */
+		bool watch = req.got_clients == 0 || req.nclients > 0;
 
-		if (json_get_int(line, "workspace_id", &workspace_id) <= 0) {
-			return ipc_send_or_drop(client, build_error_reply(id, "missing workspace_id"));
-		}
-		ws = wsbyid((unsigned int)workspace_id);
-		if (!ws) {
-			return ipc_send_or_drop(client, build_error_reply(id, "unknown workspace"));
+		if (req.got_clients < 0) {
+			return ipc_send_or_drop(client, build_error_reply(id, "invalid clients"));
 		}
+		if (watch && !client->geom_watch && !ipc_server.geom_watchers++)
+			geometry_forget();
+		else if (!watch && client->geom_watch)
+			ipc_server.geom_watchers--;
+		client->geom_watch = watch;
+		client->geom_resync = false;
+		client->ngeom_ids = req.nclients;
+		memcpy(client->geom_ids, req.clients, req.nclients * sizeof(*req.clients));
+		return ipc_send_or_drop(client, build_geometry_reply(id, client));
+	}
 
-		vout = resolve_vout(line, &error);
-		if (!vout) {
-			return ipc_send_or_drop(client, build_error_reply(id, error));
-		}
+	if (!strcmp(type, "wait"))
+		return ipc_wait_add(client, id, &req);
 
-		if (ipc_move_workspace_to_vout(ws, vout) < 0) {
-			return ipc_send_or_drop(client, build_error_reply(id, "failed to move workspace"));
+	if (!strcmp(type, "batch")) {
+		if (req.got_commands <= 0) {
+			return ipc_send_or_drop(client, build_error_reply(id, "missing commands"));
 		}
-		return ipc_send_or_drop(client, build_ok_reply(id));
+		return ipc_send_or_drop(client, run_batch(id, req.commands, req.commands_end));
 	}
 
-	if (!strcmp(type, "spawn_on_workspace")) {
-		if (json_get_int(line, "workspace_id", &workspace_id) <= 0) {
-			return ipc_send_or_drop(client, build_error_reply(id, "missing workspace_id"));
-		}
-		if (json_get_string(line, "command", command, sizeof(command)) <= 0 || !command[0]) {
-			return ipc_send_or_drop(client, build_error_reply(id, "missing command"));
-		}
-		if (ipc_spawn_on_workspace((unsigned int)workspace_id, command) < 0) {
-			return ipc_send_or_drop(client, build_error_reply(id, "failed to spawn on workspace"));
-		}
+	switch (run_command(&req, &error)) {
+	case 0:
 		return ipc_send_or_drop(client, build_ok_reply(id));
+	case -1:
+		return ipc_send_or_drop(client, build_error_reply(id, error));
 	}
 
 	return ipc_send_or_drop(client, build_error_reply(id, "unknown request type"));
@@ -660,24 +3246,61 @@ handle_request(IPCClient *client, const char *line)
 static int
 handle_client_buffer(IPCClient *client)
 {
-	char *line_start = client->buffer;
 	char *newline;
 
-	while ((newline = memchr(line_start, '\n', client->used - (size_t)(line_start - client->buffer)))) {
-		size_t line_len = (size_t)(newline - line_start);
-		if (line_len && line_start[line_len - 1] == '\r')
+	while ((newline = memchr(client->buffer + client->scanned, '\n', client->used - client->scanned))) {
+		char *line = client->buffer + client->start;
+		size_t line_len = (size_t)(newline - line);
+
+		client->start = client->scanned = (size_t)(newline - client->buffer) + 1;
+		if (client->overlong) {
+			client->overlong = false;
+			continue;
+		}
+		if (line_len && line[line_len - 1] == '\r')
 			line_len--;
-		*newline = '\0';
-		if (line_len && handle_request(client, line_start) < 0)
+		if (line_len && handle_request(client, line, line_len) < 0)
 			return -1;
-		line_start = newline + 1;
 	}
 
-	if (line_start != client->buffer) {
-		size_t remaining = client->used - (size_t)(line_start - client->buffer);
-		memmove(client->buffer, line_start, remaining);
-		client->used = remaining;
+	if (client->overlong)
+		client->start = client->used;
+	client->scanned = client->used;
+	if (client->start == client->used)
+		client->start = client->scanned = client->used = 0;
+	return 0;
+}
+
+/*
+ * Makes room to read more input. Handled lines are compacted away only when
+ * the buffer fills up, and the buffer grows while the pending request is over
+ * half of it, up to max_request. Fails if a single request reaches that.
+ */
+static int
+ipc_client_reserve(IPCClient *client)
+{
+	size_t max_request = ipc_config()->max_request;
+	size_t size;
+	char *buffer;
+
+	if (client->used < client->size)
+		return 0;
+	if (client->start) {
+		memmove(client->buffer, client->buffer + client->start, client->used - client->start);
+		client->used -= client->start;
+		client->scanned -= client->start;
+		client->start = 0;
+		if (client->used <= client->size / 2)
+			return 0;
 	}
+	if (client->size >= max_request)
+		return client->used < client->size ? 0 : -1;
+
+	size = MIN(client->size ? client->size * 2 : IPC_CLIENT_BUFFER, max_request);
+	if (!(buffer = realloc(client->buffer, size)))
+		die("realloc:");
+	client->buffer = buffer;
+	client->size = size;
 	return 0;
 }
 
@@ -690,9 +3313,23 @@ ipc_client_ready(int fd, uint32_t mask, void *data)
 		ipc_client_destroy(client);
 		return 0;
 	}
+	if ((mask & WL_EVENT_WRITABLE) && ipc_client_flush(client) < 0) {
+		ipc_client_destroy(client);
+		return 0;
+	}
+	if (!(mask & WL_EVENT_READABLE))
+		return 0;
 
 	for (;;) {
-		ssize_t n = read(fd, client->buffer + client->used, sizeof(client->buffer) - client->used - 1);
+		ssize_t n;
+
+		if (ipc_client_reserve(client) < 0) {
+			client->start = client->scanned = client->used = 0;
+			client->overlong = true;
+			if (ipc_send_or_drop(client, build_error_reply(0, "request too large")) < 0)
+				return 0;
+		}
+		n = read(fd, client->buffer + client->used, client->size - client->used);
 		if (n < 0) {
 			if (errno == EINTR)
 				continue;
@@ -702,17 +3339,15 @@ ipc_client_ready(int fd, uint32_t mask, void *data)
 			return 0;
 		}
 		if (n == 0) {
-			ipc_client_destroy(client);
+			/* pipelined requests may still have replies queued */
+			client->eof = true;
+			if (ipc_client_flush(client) < 0)
+				ipc_client_destroy(client);
 			return 0;
 		}
 		client->used += (size_t)n;
-		client->buffer[client->used] = '\0';
 		if (handle_client_buffer(client) < 0)
 			return 0;
-		if (client->used == sizeof(client->buffer) - 1) {
-			(void)ipc_send_or_drop(client, build_error_reply(0, "request too large"));
-			return 0;
-		}
 	}
 
 	return 0;
@@ -721,13 +3356,28 @@ ipc_client_ready(int fd, uint32_t mask, void *data)
 static void
 ipc_client_destroy(IPCClient *client)
 {
+	IPCMessage *msg, *tmp;
+	IPCWait *w, *wtmp;
+
 	if (!client)
 		return;
+	wl_list_for_each_safe(msg, tmp, &client->outq, link) ipc_client_drop_message(client, msg);
+	ipc_fanout_drop(client);
+	if (client->geom_watch)
+		ipc_server.geom_watchers--;
+	wl_list_for_each_safe(w, wtmp, &ipc_server.waits, link) {
+		if (w->client == client)
+			ipc_wait_destroy(w);
+	}
+	ipc_model_unref(client->rate_base);
+	if (client->rate_timer)
+		wl_event_source_remove(client->rate_timer);
 	if (client->source)
 		wl_event_source_remove(client->source);
 	if (client->fd >= 0)
 		close(client->fd);
 	wl_list_remove(&client->link);
+	free(client->buffer);
 	free(client);
 }
 
@@ -758,6 +3408,9 @@ ipc_listen_ready(int fd, uint32_t mask, void *data)
 
 		client = ecalloc(1, sizeof(*client));
 		client->fd = client_fd;
+		client->view = IPC_FIELD_ALL;
+		wl_list_init(&client->outq);
+		wl_list_init(&client->fanout_link);
 		client->source = wl_event_loop_add_fd(event_loop, client_fd,
 				WL_EVENT_READABLE | WL_EVENT_ERROR | WL_EVENT_HANGUP, ipc_client_ready, client);
 		if (!client->source) {
@@ -783,6 +3436,10 @@ ipc_init(void)
 		die("ipc: XDG_RUNTIME_DIR must be set");
 
 	wl_list_init(&ipc_server.clients);
+	wl_list_init(&ipc_server.fanout.clients);
+	wl_list_init(&ipc_server.geom_dirty);
+	wl_list_init(&ipc_server.waits);
+	wl_list_init(&ipc_server.wl_outputs);
 	if (snprintf(ipc_server.path, sizeof(ipc_server.path), "%s/vwl.sock", runtime_dir) >=
 			(int)sizeof(ipc_server.path))
 		die("ipc: socket path too long");
@@ -807,6 +3464,16 @@ ipc_init(void)
 	if (!ipc_server.listen_source)
 		die("ipc: failed to add event source");
 
+	/* without it every publish is sent to all subscribers at once */
+	ipc_server.fanout_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ipc_server.fanout_fd >= 0)
+		ipc_server.fanout_source = wl_event_loop_add_fd(
+				event_loop, ipc_server.fanout_fd, WL_EVENT_READABLE, ipc_fanout_ready, NULL);
+
+	ipc_server.wl_global = wl_global_create(dpy, &zvwl_ipc_manager_v1_interface, 1, NULL, ipc_wl_bind);
+	if (!ipc_server.wl_global)
+		die("ipc: failed to create zvwl_ipc_manager_v1");
+
 	setenv("VWL_SOCKET", ipc_server.path, 1);
 }
 
@@ -814,6 +3481,7 @@ void
 ipc_finish(void)
 {
 	IPCClient *client, *tmp;
+	size_t i;
 
 	wl_list_for_each_safe(client, tmp, &ipc_server.clients, link) ipc_client_destroy(client);
 
@@ -821,6 +3489,10 @@ ipc_finish(void)
 		wl_event_source_remove(ipc_server.listen_source);
 		ipc_server.listen_source = NULL;
 	}
+	if (ipc_server.wl_global) {
+		wl_global_destroy(ipc_server.wl_global);
+		ipc_server.wl_global = NULL;
+	}
 	if (ipc_server.listen_fd >= 0) {
 		close(ipc_server.listen_fd);
 		ipc_server.listen_fd = -1;
@@ -829,35 +3501,638 @@ ipc_finish(void)
 		unlink(ipc_server.path);
 		ipc_server.path[0] = '\0';
 	}
+	if (ipc_server.publish_source) {
+		wl_event_source_remove(ipc_server.publish_source);
+		ipc_server.publish_source = NULL;
+	}
+	if (ipc_server.fanout_source) {
+		wl_event_source_remove(ipc_server.fanout_source);
+		ipc_server.fanout_source = NULL;
+	}
+	if (ipc_server.fanout_fd >= 0) {
+		close(ipc_server.fanout_fd);
+		ipc_server.fanout_fd = -1;
+	}
+	ipc_model_unref(ipc_server.fanout.base);
+	ipc_server.fanout.base = NULL;
+	ipc_model_unref(ipc_server.last);
+	ipc_server.last = NULL;
+	ipc_model_unref(ipc_server.current);
+	ipc_server.current = NULL;
+	for (i = 0; i < ipc_server.history_len; i++)
+		ipc_model_unref(ipc_server.history[(ipc_server.history_head + i) % ipc_config()->history]);
+	free(ipc_server.history);
+	ipc_server.history = NULL;
+	ipc_server.history_head = ipc_server.history_len = 0;
+	json_buf_finish(&ipc_server.scratch);
+	json_buf_finish(&ipc_server.results);
+	for (i = 0; i < LENGTH(ipc_server.deltas); i++) {
+		json_buf_finish(&ipc_server.deltas[i]);
+		json_buf_finish(&ipc_server.frames[i]);
+	}
+	json_buf_finish(&ipc_server.records);
+	json_buf_finish(&ipc_server.strings);
+	json_buf_finish(&ipc_server.metrics);
+	free(ipc_server.geom_unmapped);
+	ipc_server.geom_unmapped = NULL;
+	ipc_server.ngeom_unmapped = ipc_server.geom_unmapped_cap = 0;
+	if (ipc_server.shm) {
+		munmap(ipc_server.shm, sizeof(*ipc_server.shm));
+		ipc_server.shm = NULL;
+	}
+	if (ipc_server.shm_fd >= 0) {
+		close(ipc_server.shm_fd);
+		ipc_server.shm_fd = -1;
+	}
+}
+
+/*
+ * Sends one subscriber the changes from the state it had reached to the last
+ * publish and takes it off the list. Returns -1 if the client was disconnected.
+ */
+static int
+ipc_fanout_client(IPCClient *client)
+{
+	IPCFanout *f = &ipc_server.fanout;
+	IPCModel *model = ipc_server.last;
+	IPCModel *base = client->fanout_base;
+	unsigned int topics = client->topics;
+	const char *deltas = NULL, *frame = NULL;
+	size_t len = 0;
+	bool resync;
+	int ret;
+
+	wl_list_remove(&client->fanout_link);
+	wl_list_init(&client->fanout_link);
+	client->fanout_base = NULL;
+	if (base == f->base) {
+		if (!f->checked[topics]) {
+			f->checked[topics] = true;
+			f->resync[topics] = !f->base || !model_outputs_match(f->base, model);
+		}
+		resync = f->resync[topics];
+		if (!resync && !client->binary && !f->built[topics]) {
+			f->built[topics] = true;
+			f->deltas[topics] = build_deltas(&ipc_server.deltas[topics], f->base, model, topics);
+		}
+		if (!resync && client->binary && !f->frames_built[topics]) {
+			f->frames_built[topics] = true;
+			f->frames[topics] = build_frame_deltas(&ipc_server.frames[topics], f->base, model, topics,
+					&f->frame_lens[topics]);
+		}
+		deltas = f->deltas[topics];
+		frame = f->frames[topics];
+		len = f->frame_lens[topics];
+	} else {
+		/* still owed an earlier publish, it gets both at once */
+		resync = !base || !model_outputs_match(base, model);
+		if (!resync && client->binary)
+			frame = build_frame_deltas(&ipc_server.scratch, base, model, topics, &len);
+		else if (!resync)
+			deltas = build_deltas(&ipc_server.scratch, base, model, topics);
+	}
+	/* nothing the subscriber asked for changed, or it is held back */
+	if ((!resync && !(client->binary ? frame : deltas)) || ipc_client_rate_hold(client, base)) {
+		ipc_model_unref(base);
+		return 0;
+	}
+
+	if (client->subscribed == IPC_SUB_SNAPSHOT || resync)
+		ret = ipc_send_state(client, model, true);
+	else if (client->binary)
+		ret = ipc_send_frame(client, frame, len, true);
+	else
+		ret = ipc_send_line(client, deltas, true);
+	ipc_model_unref(base);
+	if (ret < 0 || (client->resync && ipc_client_resync(client, model) < 0)) {
+		ipc_client_destroy(client);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Sends the publish to at most `limit` more subscribers, or to all of them if
+ * limit is 0, and wakes the loop to go on with the rest on its next iteration.
+ * An idle source would not do: one added while idle sources run is run in the
+ * same pass, before any input or frame events waiting meanwhile.
+ */
+static void
+ipc_fanout_run(size_t limit)
+{
+	IPCFanout *f = &ipc_server.fanout;
+	IPCClient *client;
+	size_t sent = 0;
+
+	while (!wl_list_empty(&f->clients)) {
+		if (limit && sent++ == limit) {
+			eventfd_write(ipc_server.fanout_fd, 1);
+			return;
+		}
+		client = wl_container_of(f->clients.next, client, fanout_link);
+		ipc_fanout_client(client);
+	}
+	ipc_model_unref(f->base);
+	f->base = NULL;
+}
+
+static int
+ipc_fanout_ready(int fd, uint32_t mask, void *data)
+{
+	eventfd_t count;
+
+	(void)mask;
+	(void)data;
+	eventfd_read(fd, &count);
+	ipc_fanout_run(ipc_config()->fanout_batch);
+	return 0;
+}
+
+static void
+ipc_publish(void)
+{
+	IPCFanout *f = &ipc_server.fanout;
+	IPCClient *client;
+	IPCModel *model;
+	bool subscribers = false;
+
+	wl_list_for_each(client, &ipc_server.clients, link) {
+		if (client->subscribed != IPC_SUB_NONE)
+			subscribers = true;
+	}
+	if (!subscribers) {
+		ipc_model_unref(ipc_server.last);
+		ipc_server.last = NULL;
+		return;
+	}
+
+	model = ipc_model_current();
+	if (model == ipc_server.last) {
+		/* no mutation since the last publish */
+		ipc_model_unref(model);
+		return;
+	}
+	memset(f->built, 0, sizeof(f->built));
+	memset(f->frames_built, 0, sizeof(f->frames_built));
+	memset(f->checked, 0, sizeof(f->checked));
+	/* subscribers still owed the previous publish keep the state they had reached */
+	ipc_model_unref(f->base);
+	f->base = ipc_server.last;
+	ipc_server.last = model;
+	ipc_history_add(model);
+	wl_list_for_each(client, &ipc_server.clients, link) {
+		if (client->subscribed == IPC_SUB_NONE || !wl_list_empty(&client->fanout_link))
+			continue;
+		wl_list_insert(f->clients.prev, &client->fanout_link);
+		client->fanout_base = f->base;
+		if (f->base)
+			f->base->refs++;
+	}
+	ipc_fanout_run(ipc_server.fanout_source ? ipc_config()->fanout_batch : 0);
+}
+
+static void
+ipc_publish_idle(void *data)
+{
+	ipc_server.publish_source = NULL;
+	ipc_server.publishes++;
+	ipc_publish();
+	ipc_wait_check();
+	ipc_wl_update();
+	ipc_shm_update();
+	update_fullscreen_idle_inhibit();
+}
+
+/*
+ * Run a pending publish now rather than at the end of this loop iteration. The
+ * idle publish stays scheduled for the rest: answering waits here could destroy
+ * the client whose request is being handled.
+ */
+static void
+ipc_flush(void)
+{
+	if (ipc_server.publish_source)
+		ipc_publish();
+}
+
+/* Invalidate the cached state without scheduling a publish. */
+void
+ipc_mark_dirty(void)
+{
+	ipc_server.generation++;
 }
 
+/*
+ * Mark state dirty; every call made during one event loop iteration is
+ * collapsed into a single publish once the loop goes idle.
+ */
 void
 updateipc(void)
 {
+	ipc_mark_dirty();
+	ipc_server.updates++;
+	if (ipc_server.publish_source || ipc_server.listen_fd < 0)
+		return;
+	ipc_server.publish_source = wl_event_loop_add_idle(event_loop, ipc_publish_idle, NULL);
+	if (!ipc_server.publish_source)
+		ipc_publish_idle(NULL);
+}
+
+/* Called from mapnotify(); answers the app_mapped waits the new window meets. */
+void
+ipc_wait_mapped(Client *c)
+{
+	IPCWait *w;
+
+	if (ipc_server.listen_fd < 0)
+		return;
+	while ((w = ipc_wait_next(c)))
+		ipc_wait_reply(w, build_wait_reply(w->id, c));
+}
+
+/* Called from resize() and arrange(); the change goes out with the client's next output frame. */
+void
+ipc_geometry_changed(Client *c)
+{
+	if (!ipc_server.geom_watchers || client_is_unmanaged(c) || !wl_list_empty(&c->ipc_geom_link))
+		return;
+	wl_list_insert(ipc_server.geom_dirty.prev, &c->ipc_geom_link);
+}
+
+void
+ipc_geometry_unmapped(Client *c)
+{
+	wl_list_remove(&c->ipc_geom_link);
+	wl_list_init(&c->ipc_geom_link);
+	c->ipc_visible = -1;
+	if (!ipc_server.geom_watchers || client_is_unmanaged(c))
+		return;
+	if (ipc_server.ngeom_unmapped == ipc_server.geom_unmapped_cap) {
+		unsigned int *ids;
+		size_t cap = MAX(ipc_server.geom_unmapped_cap * 2, 16);
+
+		if (!(ids = realloc(ipc_server.geom_unmapped, cap * sizeof(*ids))))
+			die("realloc:");
+		ipc_server.geom_unmapped = ids;
+		ipc_server.geom_unmapped_cap = cap;
+	}
+	ipc_server.geom_unmapped[ipc_server.ngeom_unmapped++] = c->id;
+}
+
+/*
+ * Sends the watchers what changed on m since its last frame, once the frame
+ * showing it is committed. Clients without an enabled output go out with any
+ * output's frame. Windows that ended up where they were are left out.
+ */
+void
+ipc_geometry_flush(Monitor *m)
+{
+	struct wl_list batch;
 	IPCClient *client, *tmp;
-	char *snapshot = NULL;
-	char *event = NULL;
-	bool have_subscribers = false;
+	Client *c, *ctmp;
+	struct wlr_box box;
+	int vout, visible;
+	const char *line;
 
-	wl_list_for_each(client, &ipc_server.clients, link) {
-		if (client->subscribed) {
-			have_subscribers = true;
-			break;
+	if (wl_list_empty(&ipc_server.geom_dirty) && !ipc_server.ngeom_unmapped && !ipc_server.geom_resync)
+		return;
+
+	wl_list_init(&batch);
+	wl_list_for_each_safe(c, ctmp, &ipc_server.geom_dirty, ipc_geom_link) {
+		if (c->mon && c->mon != m && c->mon->wlr_output->enabled)
+			continue;
+		wl_list_remove(&c->ipc_geom_link);
+		geometry_current(c, &box, &vout, &visible);
+		if (c->ipc_visible == visible && c->ipc_vout == vout && model_box_eq(&c->ipc_geom, &box)) {
+			wl_list_init(&c->ipc_geom_link);
+			continue;
+		}
+		c->ipc_geom = box;
+		c->ipc_vout = vout;
+		c->ipc_visible = visible;
+		wl_list_insert(batch.prev, &c->ipc_geom_link);
+	}
+
+	if (!wl_list_empty(&batch) || ipc_server.ngeom_unmapped || ipc_server.geom_resync) {
+		wl_list_for_each_safe(client, tmp, &ipc_server.clients, link) {
+			if (!client->geom_watch || !(line = build_geometry_event(client, &batch)))
+				continue;
+			if (ipc_send_line(client, line, true) < 0)
+				ipc_client_destroy(client);
 		}
 	}
 
-	if (have_subscribers) {
-		snapshot = build_snapshot();
-		if (snapshot)
-			event = build_event(snapshot);
+	wl_list_for_each_safe(c, ctmp, &batch, ipc_geom_link) {
+		wl_list_remove(&c->ipc_geom_link);
+		wl_list_init(&c->ipc_geom_link);
 	}
+	ipc_server.ngeom_unmapped = 0;
+	ipc_server.geom_resync = false;
+}
 
-	wl_list_for_each_safe(client, tmp, &ipc_server.clients, link) {
-		if (client->subscribed && (!event || ipc_send_line(client, event) < 0))
-			ipc_client_destroy(client);
+/*
+ * zvwl_ipc_manager_v1: the same per-output state for clients already on the
+ * Wayland display. Each zvwl_ipc_output_v1 remembers what it was last sent and
+ * gets only the events whose values differ, closed by a frame event, once per
+ * publish.
+ */
+static void
+ipc_wl_state_clear(IPCWlState *st)
+{
+	size_t i;
+
+	free(st->title);
+	free(st->appid);
+	for (i = 0; i < st->ntabs; i++) {
+		free(st->tabs[i].title);
+		free(st->tabs[i].appid);
 	}
+	free(st->tabs);
+	free(st->vouts);
+	memset(st, 0, sizeof(*st));
+}
 
-	free(event);
-	free(snapshot);
-	update_fullscreen_idle_inhibit();
+/* Same filter as the tab headers, see tabhdr_update(). */
+static bool
+ipc_wl_is_tab(Client *c, VirtualOutput *vout, Monitor *m)
+{
+	return CLIENT_VOUT(c) == vout && VISIBLEON(c, m) && !c->isfloating && !client_is_nonvirtual_fullscreen(c);
+}
+
+static void
+ipc_wl_capture(Monitor *m, IPCWlState *st)
+{
+	VirtualOutput *vout = focusedvout(m), *v;
+	Workspace *ws = vout ? vout->ws : NULL;
+	Client *c = focustop(m), *tab, *active;
+	size_t n = 0;
+
+	memset(st, 0, sizeof(*st));
+	st->active = m == selmon;
+	st->workspace = ws ? (int)ws->id : -1;
+	if (ws) {
+		snprintf(st->workspace_name, sizeof(st->workspace_name), "%s", ws->name);
+		st->clients = ws->nclients;
+		st->urgent = ws->nurgent > 0;
+	}
+	st->title = model_strdup(c ? client_get_title(c) : NULL);
+	st->appid = model_strdup(c ? client_get_appid(c) : NULL);
+	st->fullscreen = c && c->isfullscreen;
+	st->floating = c && c->isfloating;
+	if (vout)
+		snprintf(st->layout, sizeof(st->layout), "%s", vout->ltsymbol);
+
+	st->tabbed = vout && vout->lt[vout->sellt] && vout->lt[vout->sellt]->arrange == tabbed;
+	if (st->tabbed) {
+		active = focustoptiledvout(vout);
+		wl_list_for_each(tab, &clients, link) n += ipc_wl_is_tab(tab, vout, m);
+		st->tabs = ecalloc(MAX(n, 1), sizeof(*st->tabs));
+		wl_list_for_each(tab, &clients, link) {
+			if (!ipc_wl_is_tab(tab, vout, m))
+				continue;
+			if (tab == active)
+				st->tab_index = st->ntabs;
+			st->tabs[st->ntabs].title = model_strdup(client_get_title(tab));
+			st->tabs[st->ntabs++].appid = model_strdup(client_get_appid(tab));
+		}
+	}
+
+	/* zeroed, so whole entries compare with memcmp() */
+	st->vouts = ecalloc(MAX((size_t)wl_list_length(&m->vouts), 1), sizeof(*st->vouts));
+	wl_list_for_each(v, &m->vouts, link) {
+		IPCVoutModel *vm = &st->vouts[st->nvouts++];
+
+		vm->id = v->id;
+		snprintf(vm->name, sizeof(vm->name), "%s", v->name);
+		vm->focused = v == vout;
+		vm->workspace = v->ws ? (int)v->ws->id : -1;
+		if (v->ws) {
+			snprintf(vm->workspace_name, sizeof(vm->workspace_name), "%s", v->ws->name);
+			vm->clients = v->ws->nclients;
+			vm->urgent = v->ws->nurgent > 0;
+		}
+		snprintf(vm->layout, sizeof(vm->layout), "%s", v->ltsymbol);
+	}
+}
+
+static bool
+ipc_wl_tabs_eq(const IPCWlState *a, const IPCWlState *b)
+{
+	size_t i;
+
+	if (a->tabbed != b->tabbed || a->ntabs != b->ntabs || a->tab_index != b->tab_index)
+		return false;
+	for (i = 0; i < a->ntabs; i++) {
+		if (strcmp(a->tabs[i].title, b->tabs[i].title) || strcmp(a->tabs[i].appid, b->tabs[i].appid))
+			return false;
+	}
+	return true;
+}
+
+/* Sends the output object what changed since its last update, everything the first time. */
+static void
+ipc_wl_output_update(IPCWlOutput *o)
+{
+	struct wl_resource *r = o->resource;
+	IPCWlState cur, *old = &o->state;
+	bool all = !o->sent;
+	bool changed = false;
+	size_t i;
+
+	if (!o->mon)
+		return;
+	ipc_wl_capture(o->mon, &cur);
+
+	if (all || cur.active != old->active) {
+		zvwl_ipc_output_v1_send_active(r, cur.active);
+		changed = true;
+	}
+	if (cur.workspace >= 0 &&
+			(all || cur.workspace != old->workspace || strcmp(cur.workspace_name, old->workspace_name))) {
+		zvwl_ipc_output_v1_send_workspace(r, (uint32_t)cur.workspace, cur.workspace_name);
+		changed = true;
+	}
+	if (all || strcmp(cur.title, old->title)) {
+		zvwl_ipc_output_v1_send_title(r, cur.title);
+		changed = true;
+	}
+	if (all || strcmp(cur.appid, old->appid)) {
+		zvwl_ipc_output_v1_send_appid(r, cur.appid);
+		changed = true;
+	}
+	if (all || cur.fullscreen != old->fullscreen) {
+		zvwl_ipc_output_v1_send_fullscreen(r, cur.fullscreen);
+		changed = true;
+	}
+	if (all || cur.floating != old->floating) {
+		zvwl_ipc_output_v1_send_floating(r, cur.floating);
+		changed = true;
+	}
+	if (all || !ipc_wl_tabs_eq(&cur, old)) {
+		zvwl_ipc_output_v1_send_tabbed(r, cur.tabbed, (uint32_t)cur.ntabs, (uint32_t)cur.tab_index);
+		for (i = 0; i < cur.ntabs; i++)
+			zvwl_ipc_output_v1_send_tab_window(
+					r, (uint32_t)i, cur.tabs[i].title, cur.tabs[i].appid, i == cur.tab_index);
+		changed = true;
+	}
+	if (all || cur.urgent != old->urgent) {
+		zvwl_ipc_output_v1_send_urgent(r, cur.urgent);
+		changed = true;
+	}
+	if (all || cur.clients != old->clients) {
+		zvwl_ipc_output_v1_send_clients(r, cur.clients);
+		changed = true;
+	}
+	if (all || strcmp(cur.layout, old->layout)) {
+		zvwl_ipc_output_v1_send_layout_symbol(r, cur.layout);
+		changed = true;
+	}
+	if (all || cur.nvouts != old->nvouts || memcmp(cur.vouts, old->vouts, cur.nvouts * sizeof(*cur.vouts))) {
+		zvwl_ipc_output_v1_send_virtual_output_begin(r);
+		for (i = 0; i < cur.nvouts; i++) {
+			const IPCVoutModel *vm = &cur.vouts[i];
+			uint32_t workspace = vm->workspace >= 0 ? (uint32_t)vm->workspace : 0;
+
+			zvwl_ipc_output_v1_send_virtual_output(r, vm->id, vm->name, vm->focused, workspace,
+					vm->workspace_name, vm->clients, vm->urgent, vm->layout);
+		}
+		zvwl_ipc_output_v1_send_virtual_output_end(r);
+		changed = true;
+	}
+	if (changed)
+		zvwl_ipc_output_v1_send_frame(r);
+
+	ipc_wl_state_clear(old);
+	*old = cur;
+	o->sent = true;
+}
+
+/* Brings every output object up to date; a no-op until the generation moves on. */
+static void
+ipc_wl_update(void)
+{
+	IPCWlOutput *o;
+
+	if (ipc_server.wl_generation == ipc_server.generation)
+		return;
+	ipc_server.wl_generation = ipc_server.generation;
+	wl_list_for_each(o, &ipc_server.wl_outputs, link) ipc_wl_output_update(o);
+}
+
+static void
+ipc_wl_output_destroy(struct wl_resource *resource)
+{
+	IPCWlOutput *o = wl_resource_get_user_data(resource);
+
+	wl_list_remove(&o->link);
+	ipc_wl_state_clear(&o->state);
+	free(o);
+}
+
+static void
+ipc_wl_release(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+ipc_wl_output_set_workspace(struct wl_client *client, struct wl_resource *resource, uint32_t workspace_id)
+{
+	IPCWlOutput *o = wl_resource_get_user_data(resource);
+	Workspace *ws = wsbyid(workspace_id);
+
+	if (o->mon && ws)
+		ipc_move_workspace_to_vout(ws, focusedvout(o->mon));
+}
+
+static void
+ipc_wl_output_set_client_workspace(struct wl_client *client, struct wl_resource *resource, uint32_t workspace_id)
+{
+	IPCWlOutput *o = wl_resource_get_user_data(resource);
+	Workspace *ws = wsbyid(workspace_id);
+
+	if (o->mon && ws)
+		ipc_move_client_to_workspace(focustop(o->mon), ws);
+}
+
+static void
+ipc_wl_output_set_layout(struct wl_client *client, struct wl_resource *resource, uint32_t index)
+{
+	IPCWlOutput *o = wl_resource_get_user_data(resource);
+
+	if (o->mon)
+		ipc_set_layout(focusedvout(o->mon), index);
+}
+
+static void
+ipc_wl_output_set_virtual_output(struct wl_client *client, struct wl_resource *resource, uint32_t vout_id)
+{
+	IPCWlOutput *o = wl_resource_get_user_data(resource);
+	VirtualOutput *vout = voutbyid(vout_id);
+
+	if (o->mon && vout && vout->mon == o->mon)
+		ipc_focus_virtual_output(vout);
+}
+
+static const struct zvwl_ipc_output_v1_interface ipc_wl_output_impl = {
+		.release = ipc_wl_release,
+		.set_workspace = ipc_wl_output_set_workspace,
+		.set_client_workspace = ipc_wl_output_set_client_workspace,
+		.set_layout = ipc_wl_output_set_layout,
+		.set_virtual_output = ipc_wl_output_set_virtual_output,
+};
+
+static void
+ipc_wl_get_output(struct wl_client *client, struct wl_resource *resource, uint32_t id, struct wl_resource *output)
+{
+	struct wlr_output *wlr_output = wlr_output_from_resource(output);
+	IPCWlOutput *o;
+
+	o = ecalloc(1, sizeof(*o));
+	o->resource = wl_resource_create(client, &zvwl_ipc_output_v1_interface, wl_resource_get_version(resource), id);
+	if (!o->resource) {
+		free(o);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(o->resource, &ipc_wl_output_impl, o, ipc_wl_output_destroy);
+	/* an output that is already gone gets an inert object */
+	o->mon = wlr_output ? wlr_output->data : NULL;
+	wl_list_insert(ipc_server.wl_outputs.prev, &o->link);
+	ipc_wl_output_update(o);
+}
+
+static const struct zvwl_ipc_manager_v1_interface ipc_wl_manager_impl = {
+		.release = ipc_wl_release,
+		.get_output = ipc_wl_get_output,
+};
+
+static void
+ipc_wl_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource = wl_resource_create(client, &zvwl_ipc_manager_v1_interface, version, id);
+	const char *symbol;
+	unsigned int i;
+
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &ipc_wl_manager_impl, NULL, NULL);
+	for (i = 0; (symbol = ipc_layout_symbol(i)); i++)
+		zvwl_ipc_manager_v1_send_layout(resource, symbol);
+}
+
+/* Called from cleanupmon(); the output's objects stay around but get no more events. */
+void
+ipc_output_destroyed(Monitor *m)
+{
+	IPCWlOutput *o;
+
+	if (ipc_server.listen_fd < 0)
+		return;
+	wl_list_for_each(o, &ipc_server.wl_outputs, link) {
+		if (o->mon == m)
+			o->mon = NULL;
+	}
 }
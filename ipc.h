@@ -1,10 +1,233 @@
 #ifndef IPC_H
 #define IPC_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct Client Client;
+typedef struct Monitor Monitor;
+
 #define VWL_IPC_SOCKET_NAME "vwl.sock"
+#define VWL_IPC_BINARY_VERSION 1
+
+/* what to do with a subscriber whose outbound queue is full */
+enum IPCSlowPolicy {
+	IPC_SLOW_DROP_OLDEST, /* discard its oldest queued state events */
+	IPC_SLOW_DISCONNECT,
+};
+
+struct IPCConfig {
+	size_t outbound_limit; /* bytes queued per client */
+	enum IPCSlowPolicy slow_policy;
+	size_t max_request; /* longest request line accepted, in bytes */
+	size_t history; /* published states remembered for subscribe since_seq */
+	size_t fanout_batch; /* subscribers sent a publish per loop iteration, 0 for no limit */
+};
+
+/*
+ * Binary framing, negotiated with {"type":"hello","protocol":"binary"}. After
+ * the JSON reply to hello, everything the compositor sends is a frame: a
+ * VwlIpcFrame header, `count` records and then the string area, all in host
+ * byte order. Requests are still sent as JSON lines.
+ */
+enum VwlIpcFrameType {
+	VWL_IPC_FRAME_REPLY = 1, /* JSON reply text without the newline, no records */
+	VWL_IPC_FRAME_STATE, /* every record of the subscribed topics */
+	VWL_IPC_FRAME_EVENT, /* only the records that changed */
+};
+
+struct VwlIpcFrame {
+	uint32_t size; /* whole frame, header included */
+	uint16_t type;
+	uint16_t count; /* records following the header */
+	uint32_t strings; /* offset of the string area from the frame start */
+};
+
+enum VwlIpcRecordKind {
+	VWL_IPC_RECORD_FOCUS = 1,
+	VWL_IPC_RECORD_POINTER,
+	VWL_IPC_RECORD_OUTPUT,
+	VWL_IPC_RECORD_WINDOW,
+	VWL_IPC_RECORD_VOUT,
+	VWL_IPC_RECORD_WORKSPACE,
+};
+
+/* Every record starts with this; skip records of unknown kind by size. */
+struct VwlIpcRecord {
+	uint16_t kind;
+	uint16_t size;
+};
+
+/* Bytes at `offset` into the frame's string area, not NUL-terminated. */
+struct VwlIpcString {
+	uint32_t offset;
+	uint32_t len; /* VWL_IPC_NULL for a null string */
+};
+
+#define VWL_IPC_NULL UINT32_MAX
+
+struct VwlIpcBox {
+	int32_t x, y, width, height;
+};
+
+enum VwlIpcEdge {
+	VWL_IPC_EDGE_NONE,
+	VWL_IPC_EDGE_TOP,
+	VWL_IPC_EDGE_BOTTOM,
+	VWL_IPC_EDGE_LEFT,
+	VWL_IPC_EDGE_RIGHT,
+};
+
+/* Output fields are indexes of the OUTPUT records; ids and indexes are -1 when unset. */
+struct VwlIpcFocus {
+	struct VwlIpcRecord rec;
+	int32_t output;
+	int32_t vout;
+	int32_t workspace;
+};
+
+struct VwlIpcPointer {
+	struct VwlIpcRecord rec;
+	int32_t output;
+	uint8_t reveal_hover;
+	uint8_t reveal_edge; /* enum VwlIpcEdge */
+	uint8_t pad[2];
+};
+
+/* String fields come last in every record. */
+struct VwlIpcOutput {
+	struct VwlIpcRecord rec;
+	int32_t index;
+	struct VwlIpcBox geometry;
+	struct VwlIpcBox workarea;
+	int32_t active_vout;
+	uint8_t focused;
+	uint8_t pad[3];
+	struct VwlIpcString name;
+};
+
+struct VwlIpcWindow {
+	struct VwlIpcRecord rec;
+	int32_t output;
+	uint8_t present; /* the output has an active window */
+	uint8_t fullscreen;
+	uint8_t floating;
+	uint8_t tabbed;
+	struct VwlIpcString title;
+	struct VwlIpcString appid;
+};
+
+struct VwlIpcVout {
+	struct VwlIpcRecord rec;
+	uint32_t id;
+	int32_t output;
+	int32_t workspace;
+	uint32_t clients;
+	struct VwlIpcBox geometry;
+	uint8_t focused;
+	uint8_t urgent;
+	uint8_t removed; /* only set in events */
+	uint8_t pad;
+	struct VwlIpcString name;
+	struct VwlIpcString workspace_name;
+	struct VwlIpcString layout;
+};
+
+struct VwlIpcWorkspace {
+	struct VwlIpcRecord rec;
+	uint32_t id;
+	int32_t output;
+	int32_t vout;
+	uint32_t clients;
+	uint8_t assigned;
+	uint8_t visible;
+	uint8_t focused;
+	uint8_t urgent;
+	uint8_t removed; /* only set in events */
+	uint8_t pad[3];
+	struct VwlIpcString name;
+	struct VwlIpcString vout_name;
+};
+
+/*
+ * Shared state page, handed out by get_state_fd as a sealed memfd that can only
+ * be mapped read-only. The compositor rewrites it in place on every publish
+ * under a seqlock: `seq` is odd while an update is in progress and moves on by
+ * two with each one. Readers load `seq`, copy what they need, and retry if it
+ * was odd or has changed since. Ids and indexes are -1 when unset, names are
+ * NUL-terminated and truncated to fit.
+ */
+#define VWL_IPC_SHM_MAGIC 0x6c777673 /* "svwl" */
+#define VWL_IPC_SHM_VERSION 1
+#define VWL_IPC_SHM_OUTPUTS 16
+#define VWL_IPC_SHM_VOUTS 64
+#define VWL_IPC_SHM_WORKSPACES 256 /* indexed by workspace id */
+#define VWL_IPC_SHM_NAME_LEN 32
+
+struct VwlIpcShmOutput {
+	char name[VWL_IPC_SHM_NAME_LEN];
+	struct VwlIpcBox geometry;
+	struct VwlIpcBox workarea;
+	int32_t active_vout;
+	uint8_t focused;
+	uint8_t pad[3];
+};
+
+struct VwlIpcShmVout {
+	char name[VWL_IPC_SHM_NAME_LEN];
+	uint32_t id;
+	int32_t output; /* index into outputs */
+	int32_t workspace;
+	uint32_t clients;
+	struct VwlIpcBox geometry;
+	uint8_t focused;
+	uint8_t urgent;
+	uint8_t pad[2];
+};
+
+/* Workspaces that are not listed are all zero. */
+struct VwlIpcShmWorkspace {
+	char name[VWL_IPC_SHM_NAME_LEN];
+	int32_t output; /* index into outputs */
+	int32_t vout;
+	uint32_t clients;
+	uint8_t listed;
+	uint8_t assigned;
+	uint8_t visible;
+	uint8_t focused;
+	uint8_t urgent;
+	uint8_t pad[3];
+};
+
+struct VwlIpcShmState {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size; /* of this struct, check it before trusting the arrays */
+	uint32_t seq;
+	uint64_t generation; /* of the published state, as in get_stats */
+	int32_t focused_output; /* index into outputs */
+	int32_t focused_vout;
+	int32_t focused_workspace;
+	int32_t pointer_output;
+	uint8_t reveal_hover;
+	uint8_t reveal_edge; /* enum VwlIpcEdge */
+	uint8_t pad[2];
+	uint32_t noutputs;
+	uint32_t nvouts;
+	struct VwlIpcShmOutput outputs[VWL_IPC_SHM_OUTPUTS];
+	struct VwlIpcShmVout vouts[VWL_IPC_SHM_VOUTS];
+	struct VwlIpcShmWorkspace workspaces[VWL_IPC_SHM_WORKSPACES];
+};
 
+const struct IPCConfig *ipc_config(void);
 void ipc_init(void);
 void ipc_finish(void);
+void ipc_mark_dirty(void);
 void updateipc(void);
+void ipc_geometry_changed(Client *c);
+void ipc_geometry_unmapped(Client *c);
+void ipc_geometry_flush(Monitor *m);
+void ipc_wait_mapped(Client *c);
+void ipc_output_destroyed(Monitor *m);
 
 #endif
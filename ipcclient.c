@@ -0,0 +1,83 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ipc.h"
+#include "ipcclient.h"
+
+const char *
+vwl_ipc_socket_path(char *buf, size_t buf_sz)
+{
+	const char *socket = getenv("VWL_SOCKET");
+	const char *runtime_dir;
+
+	if (socket && *socket)
+		return socket;
+
+	runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (!runtime_dir || !*runtime_dir) {
+		errno = ENOENT;
+		return NULL;
+	}
+	if (snprintf(buf, buf_sz, "%s/%s", runtime_dir, VWL_IPC_SOCKET_NAME) >= (int)buf_sz) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	return buf;
+}
+
+int
+vwl_ipc_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		int err = errno;
+
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return fd;
+}
+
+int
+vwl_ipc_read_frame(FILE *fp, char **frame, size_t *cap)
+{
+	struct VwlIpcFrame hdr;
+	char *grown;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1)
+		return 0;
+	if (hdr.size < sizeof(hdr) || hdr.strings < sizeof(hdr) || hdr.strings > hdr.size) {
+		errno = EPROTO;
+		return -1;
+	}
+	if (hdr.size + 1 > *cap) {
+		if (!(grown = realloc(*frame, hdr.size + 1)))
+			return -1;
+		*frame = grown;
+		*cap = hdr.size + 1;
+	}
+	memcpy(*frame, &hdr, sizeof(hdr));
+	if (hdr.size > sizeof(hdr) && fread(*frame + sizeof(hdr), hdr.size - sizeof(hdr), 1, fp) != 1) {
+		errno = EPROTO;
+		return -1;
+	}
+	(*frame)[hdr.size] = '\0';
+	return 1;
+}
@@ -0,0 +1,22 @@
+#ifndef IPCCLIENT_H
+#define IPCCLIENT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * What vwlctl and vwl-bar share to talk to the compositor. Errors are left in
+ * errno rather than passed to die(), so each tool reports them under its name.
+ */
+
+/* VWL_SOCKET, or the default socket in XDG_RUNTIME_DIR built in buf; NULL if neither is known. */
+const char *vwl_ipc_socket_path(char *buf, size_t buf_sz);
+int vwl_ipc_connect(const char *path);
+/*
+ * Reads one binary frame into *frame, growing it to *cap as needed, and NUL
+ * terminates it. Returns 1, 0 at the end of the stream, or -1 if the frame is
+ * malformed or truncated.
+ */
+int vwl_ipc_read_frame(FILE *fp, char **frame, size_t *cap);
+
+#endif
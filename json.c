@@ -0,0 +1,481 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "json.h"
+#include "util.h"
+
+#define JSON_MAX_DEPTH 32 /* nesting json_skip_value() will follow */
+#define MIN(A, B) ((A) < (B) ? (A) : (B))
+
+static const char json_hex[] = "0123456789abcdef";
+
+static void
+json_reserve(JsonBuf *buf, size_t extra)
+{
+	size_t cap = buf->cap ? buf->cap : 256;
+	char *data;
+
+	/* always keep room for the terminating NUL */
+	if (buf->len + extra < buf->cap)
+		return;
+	while (cap <= buf->len + extra)
+		cap *= 2;
+	if (!(data = realloc(buf->data, cap)))
+		die("realloc:");
+	buf->data = data;
+	buf->cap = cap;
+}
+
+void
+json_buf_reset(JsonBuf *buf)
+{
+	buf->len = 0;
+}
+
+void
+json_buf_finish(JsonBuf *buf)
+{
+	free(buf->data);
+	buf->data = NULL;
+	buf->len = buf->cap = 0;
+}
+
+/* Returns the NUL-terminated contents; valid until the buffer is written again. */
+char *
+json_buf_str(JsonBuf *buf)
+{
+	json_reserve(buf, 0);
+	buf->data[buf->len] = '\0';
+	return buf->data;
+}
+
+char *
+json_buf_dup(JsonBuf *buf)
+{
+	char *copy = malloc(buf->len + 1);
+
+	if (!copy)
+		die("malloc:");
+	memcpy(copy, json_buf_str(buf), buf->len + 1);
+	return copy;
+}
+
+void
+json_write(JsonBuf *buf, const char *data, size_t len)
+{
+	if (!len)
+		return;
+	json_reserve(buf, len);
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+void
+json_write_str(JsonBuf *buf, const char *str)
+{
+	json_write(buf, str, strlen(str));
+}
+
+void
+json_write_char(JsonBuf *buf, char ch)
+{
+	json_reserve(buf, 1);
+	buf->data[buf->len++] = ch;
+}
+
+void
+json_write_uint(JsonBuf *buf, unsigned long value)
+{
+	char digits[3 * sizeof(value)];
+	char *p = digits + sizeof(digits);
+
+	do {
+		*--p = (char)('0' + value % 10);
+		value /= 10;
+	} while (value);
+	json_write(buf, p, (size_t)(digits + sizeof(digits) - p));
+}
+
+void
+json_write_int(JsonBuf *buf, long value)
+{
+	if (value < 0) {
+		json_write_char(buf, '-');
+		json_write_uint(buf, 0UL - (unsigned long)value);
+		return;
+	}
+	json_write_uint(buf, (unsigned long)value);
+}
+
+void
+json_write_bool(JsonBuf *buf, bool value)
+{
+	if (value)
+		json_write(buf, "true", 4);
+	else
+		json_write(buf, "false", 5);
+}
+
+static bool
+json_needs_escape(unsigned char ch)
+{
+	return ch == '"' || ch == '\\' || ch < 0x20;
+}
+
+/* Length of the leading run of bytes that can be copied without escaping. */
+static size_t
+json_clean_span(const unsigned char *p, size_t len)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1f);
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(const void *)(p + i));
+		/* max(chunk, 0x1f) == 0x1f is an unsigned chunk <= 0x1f */
+		__m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+				_mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+		int mask = _mm_movemask_epi8(hits);
+
+		if (mask)
+			return i + (size_t)__builtin_ctz((unsigned int)mask);
+	}
+#else
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t highs = 0x8080808080808080ULL;
+
+	for (; i + 8 <= len; i += 8) {
+		uint64_t word, quotes, backslashes, controls;
+
+		memcpy(&word, p + i, sizeof(word));
+		/* classic has-zero-byte / has-byte-less-than tests, eight bytes at a time */
+		quotes = ((word ^ (ones * '"')) - ones) & ~(word ^ (ones * '"')) & highs;
+		backslashes = ((word ^ (ones * '\\')) - ones) & ~(word ^ (ones * '\\')) & highs;
+		controls = (word - ones * 0x20) & ~word & highs;
+		if (quotes | backslashes | controls)
+			break;
+	}
+#endif
+	while (i < len && !json_needs_escape(p[i]))
+		i++;
+	return i;
+}
+
+static char *
+json_escape_byte(char *out, unsigned char ch)
+{
+	*out++ = '\\';
+	switch (ch) {
+	case '"':
+	case '\\':
+		*out++ = (char)ch;
+		break;
+	case '\b':
+		*out++ = 'b';
+		break;
+	case '\f':
+		*out++ = 'f';
+		break;
+	case '\n':
+		*out++ = 'n';
+		break;
+	case '\r':
+		*out++ = 'r';
+		break;
+	case '\t':
+		*out++ = 't';
+		break;
+	default:
+		*out++ = 'u';
+		*out++ = '0';
+		*out++ = '0';
+		*out++ = json_hex[ch >> 4];
+		*out++ = json_hex[ch & 0xf];
+		break;
+	}
+	return out;
+}
+
+/* Writes value as a quoted JSON string, copying runs of clean bytes in bulk. */
+void
+json_write_escaped(JsonBuf *buf, const char *value)
+{
+	const unsigned char *p = (const unsigned char *)(value ? value : "");
+	size_t len = strlen((const char *)p);
+	const unsigned char *end = p + len;
+	char *out;
+
+	/* worst case: every byte becomes \u00XX */
+	json_reserve(buf, len * 6 + 2);
+	out = buf->data + buf->len;
+	*out++ = '"';
+	while (p < end) {
+		size_t span = json_clean_span(p, (size_t)(end - p));
+
+		memcpy(out, p, span);
+		out += span;
+		p += span;
+		if (p < end)
+			out = json_escape_byte(out, *p++);
+	}
+	*out++ = '"';
+	buf->len = (size_t)(out - buf->data);
+}
+
+const char *
+json_skip_ws(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+	return p;
+}
+
+static int
+json_hex_value(char ch)
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	if (ch >= 'a' && ch <= 'f')
+		return ch - 'a' + 10;
+	if (ch >= 'A' && ch <= 'F')
+		return ch - 'A' + 10;
+	return -1;
+}
+
+static const char *
+json_read_hex4(const char *p, const char *end, unsigned long *value)
+{
+	int i, digit;
+
+	if (end - p < 4)
+		return NULL;
+	*value = 0;
+	for (i = 0; i < 4; i++) {
+		if ((digit = json_hex_value(p[i])) < 0)
+			return NULL;
+		*value = *value << 4 | (unsigned long)digit;
+	}
+	return p + 4;
+}
+
+/* Decodes the hex digits of a \u escape into UTF-8, joining surrogate pairs. */
+static const char *
+json_read_unicode(const char *p, const char *end, char *utf8, size_t *len)
+{
+	unsigned long cp, low;
+
+	if (!(p = json_read_hex4(p, end, &cp)))
+		return NULL;
+	if (cp >= 0xdc00 && cp <= 0xdfff)
+		return NULL;
+	if (cp >= 0xd800 && cp <= 0xdbff) {
+		if (end - p < 2 || p[0] != '\\' || p[1] != 'u' || !(p = json_read_hex4(p + 2, end, &low)) ||
+				low < 0xdc00 || low > 0xdfff)
+			return NULL;
+		cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+	}
+
+	if (cp < 0x80) {
+		utf8[0] = (char)cp;
+		*len = 1;
+	} else if (cp < 0x800) {
+		utf8[0] = (char)(0xc0 | cp >> 6);
+		utf8[1] = (char)(0x80 | (cp & 0x3f));
+		*len = 2;
+	} else if (cp < 0x10000) {
+		utf8[0] = (char)(0xe0 | cp >> 12);
+		utf8[1] = (char)(0x80 | (cp >> 6 & 0x3f));
+		utf8[2] = (char)(0x80 | (cp & 0x3f));
+		*len = 3;
+	} else {
+		utf8[0] = (char)(0xf0 | cp >> 18);
+		utf8[1] = (char)(0x80 | (cp >> 12 & 0x3f));
+		utf8[2] = (char)(0x80 | (cp >> 6 & 0x3f));
+		utf8[3] = (char)(0x80 | (cp & 0x3f));
+		*len = 4;
+	}
+	return p;
+}
+
+static void
+json_copy_out(char *out, size_t out_sz, size_t at, const char *data, size_t len)
+{
+	if (at + 1 >= out_sz)
+		return;
+	memcpy(out + at, data, MIN(len, out_sz - 1 - at));
+}
+
+/*
+ * Decodes the string at p into out, truncated to out_sz - 1 bytes and always
+ * NUL-terminated when out_sz is non-zero. *len, if given, receives the full
+ * decoded length so callers can tell truncation apart from a fit.
+ */
+const char *
+json_read_string(const char *p, const char *end, char *out, size_t out_sz, size_t *len)
+{
+	size_t n = 0;
+
+	if (p >= end || *p++ != '"')
+		return NULL;
+	for (;;) {
+		size_t span = json_clean_span((const unsigned char *)p, (size_t)(end - p));
+		char utf8[4];
+		size_t ulen = 1;
+
+		json_copy_out(out, out_sz, n, p, span);
+		n += span;
+		p += span;
+		if (p >= end)
+			return NULL;
+		if (*p == '"')
+			break;
+		if (*p != '\\')
+			return NULL; /* raw control character */
+		if (++p >= end)
+			return NULL;
+		switch (*p++) {
+		case '"':
+		case '\\':
+		case '/':
+			utf8[0] = p[-1];
+			break;
+		case 'b':
+			utf8[0] = '\b';
+			break;
+		case 'f':
+			utf8[0] = '\f';
+			break;
+		case 'n':
+			utf8[0] = '\n';
+			break;
+		case 'r':
+			utf8[0] = '\r';
+			break;
+		case 't':
+			utf8[0] = '\t';
+			break;
+		case 'u':
+			if (!(p = json_read_unicode(p, end, utf8, &ulen)))
+				return NULL;
+			break;
+		default:
+			return NULL;
+		}
+		json_copy_out(out, out_sz, n, utf8, ulen);
+		n += ulen;
+	}
+
+	if (out_sz)
+		out[MIN(n, out_sz - 1)] = '\0';
+	if (len)
+		*len = n;
+	return p + 1;
+}
+
+/* Reads an integral number; fractions, exponents and out of range values are rejected. */
+const char *
+json_read_int(const char *p, const char *end, long *value)
+{
+	bool negative = p < end && *p == '-';
+	unsigned long magnitude = 0, limit;
+	const char *digits;
+
+	if (negative)
+		p++;
+	limit = negative ? 0UL - (unsigned long)LONG_MIN : (unsigned long)LONG_MAX;
+	for (digits = p; p < end && *p >= '0' && *p <= '9'; p++) {
+		unsigned long digit = (unsigned long)(*p - '0');
+
+		if (magnitude > (limit - digit) / 10)
+			return NULL;
+		magnitude = magnitude * 10 + digit;
+	}
+	if (p == digits || (p < end && (*p == '.' || *p == 'e' || *p == 'E')))
+		return NULL;
+	*value = negative ? (long)(0UL - magnitude) : (long)magnitude;
+	return p;
+}
+
+static const char *
+json_skip_literal(const char *p, const char *end, const char *literal)
+{
+	size_t len = strlen(literal);
+
+	if ((size_t)(end - p) < len || memcmp(p, literal, len))
+		return NULL;
+	return p + len;
+}
+
+static const char *
+json_skip_number(const char *p, const char *end)
+{
+	const char *start = p;
+
+	while (p < end && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E'))
+		p++;
+	return p == start ? NULL : p;
+}
+
+static const char *
+json_skip_nested(const char *p, const char *end, int depth)
+{
+	char close;
+
+	p = json_skip_ws(p, end);
+	if (p >= end)
+		return NULL;
+	switch (*p) {
+	case '"':
+		return json_read_string(p, end, NULL, 0, NULL);
+	case 't':
+		return json_skip_literal(p, end, "true");
+	case 'f':
+		return json_skip_literal(p, end, "false");
+	case 'n':
+		return json_skip_literal(p, end, "null");
+	case '{':
+	case '[':
+		break;
+	default:
+		return json_skip_number(p, end);
+	}
+
+	if (depth >= JSON_MAX_DEPTH)
+		return NULL;
+	close = *p == '{' ? '}' : ']';
+	p = json_skip_ws(p + 1, end);
+	if (p < end && *p == close)
+		return p + 1;
+	for (;;) {
+		if (close == '}') {
+			if (!(p = json_read_string(p, end, NULL, 0, NULL)))
+				return NULL;
+			p = json_skip_ws(p, end);
+			if (p >= end || *p++ != ':')
+				return NULL;
+		}
+		if (!(p = json_skip_nested(p, end, depth + 1)))
+			return NULL;
+		p = json_skip_ws(p, end);
+		if (p >= end)
+			return NULL;
+		if (*p == close)
+			return p + 1;
+		if (*p++ != ',')
+			return NULL;
+		p = json_skip_ws(p, end);
+	}
+}
+
+/* Steps over one value of any type, including nested objects and arrays. */
+const char *
+json_skip_value(const char *p, const char *end)
+{
+	return json_skip_nested(p, end, 0);
+}
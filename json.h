@@ -0,0 +1,36 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Growable output buffer; reset and reuse it instead of freeing between documents. */
+typedef struct JsonBuf {
+	char *data;
+	size_t len;
+	size_t cap;
+} JsonBuf;
+
+void json_buf_reset(JsonBuf *buf);
+void json_buf_finish(JsonBuf *buf);
+char *json_buf_str(JsonBuf *buf);
+char *json_buf_dup(JsonBuf *buf);
+
+void json_write(JsonBuf *buf, const char *data, size_t len);
+void json_write_str(JsonBuf *buf, const char *str);
+void json_write_char(JsonBuf *buf, char ch);
+void json_write_int(JsonBuf *buf, long value);
+void json_write_uint(JsonBuf *buf, unsigned long value);
+void json_write_bool(JsonBuf *buf, bool value);
+void json_write_escaped(JsonBuf *buf, const char *value);
+
+/*
+ * Readers take the unread input as [p, end) and return the position just past
+ * what they consumed, or NULL if the input there is malformed.
+ */
+const char *json_skip_ws(const char *p, const char *end);
+const char *json_skip_value(const char *p, const char *end);
+const char *json_read_string(const char *p, const char *end, char *out, size_t out_sz, size_t *len);
+const char *json_read_int(const char *p, const char *end, long *value);
+
+#endif
@@ -131,6 +131,7 @@ int locked;
 void *exclusive_focus;
 CursorPhysical cursor_phys;
 pid_t child_pid = -1;
+Metrics metrics;
 struct wlr_idle_notifier_v1 *idle_notifier;
 struct wlr_idle_inhibit_manager_v1 *idle_inhibit_mgr;
 static int fullscreen_idle_active;
@@ -907,11 +908,15 @@ rendermon(struct wl_listener *listener, void *data)
 	/* Render if no XDG clients have an outstanding resize and are visible on
 	 * this monitor. */
 	wl_list_for_each(c, &clients, link) {
-		if (c->resize && client_is_rendered_on_mon(c, m) && !client_is_stopped(c))
+		if (c->resize && client_is_rendered_on_mon(c, m) && !client_is_stopped(c)) {
+			m->frames_skipped++;
 			goto skip;
+		}
 	}
 
 	wlr_scene_output_commit(m->scene_output, NULL);
+	m->frames_committed++;
+	ipc_geometry_flush(m);
 
 skip:
 	/* Let clients know a frame has been rendered */
@@ -925,6 +930,7 @@ createlayersurface(struct wl_listener *listener, void *data)
 {
 	struct wlr_layer_surface_v1 *layer_surface = data;
 	LayerSurface *l;
+	const LayerRule *r;
 	struct wlr_surface *surface = layer_surface->surface;
 	struct wlr_scene_tree *scene_layer = layers[layermap[layer_surface->pending.layer]];
 
@@ -944,6 +950,10 @@ createlayersurface(struct wl_listener *listener, void *data)
 
 	l->layer_surface = layer_surface;
 	l->mon = layer_surface->output->data;
+	for (r = layerrules; r < END(layerrules); r++) {
+		if (layer_surface->namespace && strstr(layer_surface->namespace, r->namespace))
+			l->autohide = r->autohide;
+	}
 	l->scene_layer = wlr_scene_layer_surface_v1_create(scene_layer, layer_surface);
 	l->scene = l->scene_layer->tree;
 	l->popups = surface->data = wlr_scene_tree_create(
@@ -1534,6 +1544,7 @@ unmaplayersurfacenotify(struct wl_listener *listener, void *data)
 	LayerSurface *l = wl_container_of(listener, l, unmap);
 
 	l->mapped = 0;
+	l->revealed = 0;
 	wlr_scene_node_set_enabled(&l->scene->node, 0);
 	if (l == exclusive_focus)
 		exclusive_focus = NULL;
@@ -1544,6 +1555,24 @@ unmaplayersurfacenotify(struct wl_listener *listener, void *data)
 	motionnotify(0, NULL, 0, 0, 0, 0);
 }
 
+/* The edge a bar sits on: the anchored side whose opposite is free, preferring top/bottom for corners */
+static int
+layeredge(uint32_t anchor)
+{
+	int top = anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP, bottom = anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM;
+	int left = anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT, right = anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT;
+
+	if (top && !bottom)
+		return POINTER_REVEAL_EDGE_TOP;
+	if (bottom && !top)
+		return POINTER_REVEAL_EDGE_BOTTOM;
+	if (left && !right)
+		return POINTER_REVEAL_EDGE_LEFT;
+	if (right && !left)
+		return POINTER_REVEAL_EDGE_RIGHT;
+	return POINTER_REVEAL_EDGE_NONE;
+}
+
 void
 arrangelayer(Monitor *m, struct wl_list *list, struct wlr_box *usable_area, int exclusive)
 {
@@ -1556,10 +1585,21 @@ arrangelayer(Monitor *m, struct wl_list *list, struct wlr_box *usable_area, int
 		if (!layer_surface->initialized)
 			continue;
 
-		if (exclusive != (layer_surface->current.exclusive_zone > 0))
+		if (exclusive != (layer_surface->current.exclusive_zone > 0 && !l->autohide))
 			continue;
 
-		wlr_scene_layer_surface_v1_configure(l->scene_layer, &full_area, usable_area);
+		if (l->autohide) {
+			/* Overlay the windows: revealing must not re-tile the monitor */
+			struct wlr_box scratch = *usable_area;
+
+			wlr_scene_layer_surface_v1_configure(l->scene_layer, &full_area, &scratch);
+			l->reveal_edge = layeredge(layer_surface->current.anchor);
+			/* Mapping re-enables the scene tree behind our back */
+			wlr_scene_node_set_enabled(&l->scene->node, l->mapped && l->revealed);
+			wlr_scene_node_set_enabled(&l->popups->node, l->revealed);
+		} else {
+			wlr_scene_layer_surface_v1_configure(l->scene_layer, &full_area, usable_area);
+		}
 		wlr_scene_node_set_position(&l->popups->node, l->scene->node.x, l->scene->node.y);
 	}
 }
@@ -1592,7 +1632,8 @@ arrangelayers(Monitor *m)
 	/* Find topmost keyboard interactive layer, if such a layer exists */
 	for (i = 0; i < (int)LENGTH(layers_above_shell); i++) {
 		wl_list_for_each_reverse(l, &m->layers[layers_above_shell[i]], link) {
-			if (locked || !l->layer_surface->current.keyboard_interactive || !l->mapped)
+			if (locked || !l->layer_surface->current.keyboard_interactive || !l->mapped
+					|| (l->autohide && !l->revealed))
 				continue;
 			/* Deactivate the focused client. */
 			focusclient(NULL, 0);
@@ -1603,6 +1644,40 @@ arrangelayers(Monitor *m)
 	}
 }
 
+/*
+ * Shows autohide layer surfaces on the pointer's monitor while the pointer is at their edge, and keeps them up
+ * while it stays over them; everything else with autohide is hidden. Called on every pointer motion.
+ */
+void
+updatelayerreveal(Monitor *pointer_mon, int edge)
+{
+	Monitor *m;
+	LayerSurface *l;
+	struct wlr_box box;
+	int i, reveal;
+
+	wl_list_for_each(m, &mons, link) {
+		for (i = 0; i < (int)LENGTH(m->layers); i++) {
+			wl_list_for_each(l, &m->layers[i], link) {
+				if (!l->autohide || !l->mapped)
+					continue;
+				box.x = l->scene->node.x;
+				box.y = l->scene->node.y;
+				box.width = l->layer_surface->current.actual_width;
+				box.height = l->layer_surface->current.actual_height;
+				reveal = m == pointer_mon && edge != POINTER_REVEAL_EDGE_NONE && l->reveal_edge == edge;
+				if (!reveal && l->revealed && m == pointer_mon)
+					reveal = wlr_box_contains_point(&box, cursor->x, cursor->y);
+				if (reveal == l->revealed)
+					continue;
+				l->revealed = reveal;
+				wlr_scene_node_set_enabled(&l->scene->node, reveal);
+				wlr_scene_node_set_enabled(&l->popups->node, reveal);
+			}
+		}
+	}
+}
+
 void
 destroydecoration(struct wl_listener *listener, void *data)
 {
@@ -23,6 +23,7 @@ static struct wlr_renderer *share_renderer;
 static bool ensureimagesource(Client *c);
 static bool ensurevoutimagesource(VirtualOutput *vout);
 static void imagesourcedestroy(struct wl_listener *listener, void *data);
+static void imagesourceframe(struct wl_listener *listener, void *data);
 static void voutimagesourcedestroy(struct wl_listener *listener, void *data);
 static void handlenewforeigntoplevelcapturerequest(struct wl_listener *listener, void *data);
 
@@ -208,6 +209,8 @@ share_destroy(Client *c)
 	if (c->image_capture_source) {
 		wl_list_remove(&c->image_capture_source_destroy.link);
 		wl_list_init(&c->image_capture_source_destroy.link);
+		wl_list_remove(&c->image_capture_frame.link);
+		wl_list_init(&c->image_capture_frame.link);
 		c->image_capture_source = NULL;
 	}
 
@@ -403,6 +406,8 @@ outputcommit(struct wlr_output *output, const struct wlr_output_state *state)
 	pixman_region32_init_rect(&full_damage, 0, 0, buffer->width, buffer->height);
 	damage = (state->committed & WLR_OUTPUT_STATE_DAMAGE) ? &state->damage : &full_damage;
 
+	if (source->vout)
+		source->vout->capture_frames++;
 	clock_gettime(CLOCK_MONOTONIC, &now);
 	frame_event = (struct vout_image_source_frame_event){
 			.base = {.damage = damage},
@@ -542,6 +547,7 @@ ensureimagesource(Client *c)
 		return false;
 
 	LISTEN(&c->image_capture_source->events.destroy, &c->image_capture_source_destroy, imagesourcedestroy);
+	LISTEN(&c->image_capture_source->events.frame, &c->image_capture_frame, imagesourceframe);
 	return true;
 }
 
@@ -553,9 +559,20 @@ imagesourcedestroy(struct wl_listener *listener, void *data)
 
 	wl_list_remove(&c->image_capture_source_destroy.link);
 	wl_list_init(&c->image_capture_source_destroy.link);
+	wl_list_remove(&c->image_capture_frame.link);
+	wl_list_init(&c->image_capture_frame.link);
 	c->image_capture_source = NULL;
 }
 
+static void
+imagesourceframe(struct wl_listener *listener, void *data)
+{
+	(void)listener;
+	(void)data;
+
+	metrics.toplevel_capture_frames++;
+}
+
 static void
 voutimagesourcedestroy(struct wl_listener *listener, void *data)
 {
@@ -63,6 +63,14 @@ prune_pending_spawns(void)
 	}
 }
 
+/* Spawns still waiting for their first window, not counting expired ones. */
+size_t
+spawnrules_pending(void)
+{
+	prune_pending_spawns();
+	return (size_t)wl_list_length(&pending_spawns);
+}
+
 static int
 pid_descends_from(pid_t pid, pid_t ancestor)
 {
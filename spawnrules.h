@@ -2,12 +2,14 @@
 #define SPAWNRULES_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct Client Client;
 
 void spawnrules_init(void);
 void spawnrules_finish(void);
 bool spawnrules_apply(Client *c);
+size_t spawnrules_pending(void);
 int spawnrules_spawn_on_workspace_argv(unsigned int workspace_id, const char *const argv[]);
 int ipc_spawn_on_workspace(unsigned int workspace_id, const char *command);
 
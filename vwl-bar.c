@@ -0,0 +1,352 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ipc.h"
+#include "ipcclient.h"
+#include "json.h"
+#include "util.h"
+
+#define BAR_OUTPUTS 16
+#define BAR_VOUTS 64
+#define BAR_NAME_LEN 64
+
+enum { MODULE_WORKSPACES, MODULE_LAYOUT, MODULE_TITLE };
+
+static const char *const module_names[] = {"workspaces", "layout", "title"};
+/* IPC topics each module is drawn from */
+static const char *const module_topics[] = {"[\"outputs\",\"workspaces\"]", "[\"outputs\"]",
+		"[\"outputs\",\"windows\"]"};
+
+struct BarOutput {
+	bool present;
+	char name[BAR_NAME_LEN];
+	bool focused;
+	int32_t active_vout;
+	/* its active window, see VwlIpcWindow */
+	bool window;
+	bool fullscreen, tabbed;
+	char title[512];
+	char appid[BAR_NAME_LEN * 2];
+};
+
+struct BarVout {
+	bool present;
+	uint32_t id;
+	char name[BAR_NAME_LEN];
+	char layout[16];
+};
+
+struct BarWorkspace {
+	bool listed;
+	int32_t output;
+	bool visible, focused, urgent;
+	char name[BAR_NAME_LEN];
+};
+
+/* The compositor state the bar draws from, kept up to date by event frames. */
+static struct {
+	struct BarOutput outputs[BAR_OUTPUTS];
+	struct BarVout vouts[BAR_VOUTS];
+	struct BarWorkspace workspaces[VWL_IPC_SHM_WORKSPACES];
+} state;
+
+static void
+usage(FILE *fp)
+{
+	fprintf(fp, "usage: vwl-bar [--socket PATH] [--output NAME] workspaces|layout|title\n");
+}
+
+/* Copies a frame string into out, truncating it; a null or out of range string becomes "". */
+static void
+frame_string(const char *frame, struct VwlIpcString str, char *out, size_t out_sz)
+{
+	const struct VwlIpcFrame *hdr = (const struct VwlIpcFrame *)(const void *)frame;
+	size_t area = hdr->size - hdr->strings;
+	size_t len;
+
+	out[0] = '\0';
+	if (str.len == VWL_IPC_NULL || str.offset > area || str.len > area - str.offset)
+		return;
+	len = str.len < out_sz - 1 ? str.len : out_sz - 1;
+	memcpy(out, frame + hdr->strings + str.offset, len);
+	out[len] = '\0';
+}
+
+static struct BarVout *
+find_vout(uint32_t id, bool add)
+{
+	struct BarVout *free_slot = NULL;
+	size_t i;
+
+	for (i = 0; i < BAR_VOUTS; i++) {
+		if (state.vouts[i].present && state.vouts[i].id == id)
+			return &state.vouts[i];
+		if (!state.vouts[i].present && !free_slot)
+			free_slot = &state.vouts[i];
+	}
+	return add ? free_slot : NULL;
+}
+
+/* Applies the records of a frame; a state frame replaces everything known. */
+static void
+apply_frame(const char *frame)
+{
+	const struct VwlIpcFrame *hdr = (const struct VwlIpcFrame *)(const void *)frame;
+	const char *p = frame + sizeof(*hdr);
+	struct VwlIpcRecord rec;
+	unsigned int i;
+
+	if (hdr->type == VWL_IPC_FRAME_STATE)
+		memset(&state, 0, sizeof(state));
+
+	for (i = 0; i < hdr->count; i++, p += rec.size) {
+		if ((size_t)(frame + hdr->strings - p) < sizeof(rec))
+			die("vwl-bar: malformed frame");
+		memcpy(&rec, p, sizeof(rec));
+		if (rec.size < sizeof(rec) || (size_t)(frame + hdr->strings - p) < rec.size)
+			die("vwl-bar: malformed frame");
+
+		if (rec.kind == VWL_IPC_RECORD_OUTPUT && rec.size >= sizeof(struct VwlIpcOutput)) {
+			struct VwlIpcOutput r;
+			struct BarOutput *out;
+
+			memcpy(&r, p, sizeof(r));
+			if (r.index < 0 || r.index >= BAR_OUTPUTS)
+				continue;
+			out = &state.outputs[r.index];
+			out->present = true;
+			out->focused = r.focused;
+			out->active_vout = r.active_vout;
+			frame_string(frame, r.name, out->name, sizeof(out->name));
+		} else if (rec.kind == VWL_IPC_RECORD_WINDOW && rec.size >= sizeof(struct VwlIpcWindow)) {
+			struct VwlIpcWindow r;
+			struct BarOutput *out;
+
+			memcpy(&r, p, sizeof(r));
+			if (r.output < 0 || r.output >= BAR_OUTPUTS)
+				continue;
+			out = &state.outputs[r.output];
+			out->window = r.present;
+			out->fullscreen = r.fullscreen;
+			out->tabbed = r.tabbed;
+			frame_string(frame, r.title, out->title, sizeof(out->title));
+			frame_string(frame, r.appid, out->appid, sizeof(out->appid));
+		} else if (rec.kind == VWL_IPC_RECORD_VOUT && rec.size >= sizeof(struct VwlIpcVout)) {
+			struct VwlIpcVout r;
+			struct BarVout *vout;
+
+			memcpy(&r, p, sizeof(r));
+			if (!(vout = find_vout(r.id, !r.removed)))
+				continue;
+			vout->present = !r.removed;
+			vout->id = r.id;
+			frame_string(frame, r.name, vout->name, sizeof(vout->name));
+			frame_string(frame, r.layout, vout->layout, sizeof(vout->layout));
+		} else if (rec.kind == VWL_IPC_RECORD_WORKSPACE && rec.size >= sizeof(struct VwlIpcWorkspace)) {
+			struct VwlIpcWorkspace r;
+			struct BarWorkspace *ws;
+
+			memcpy(&r, p, sizeof(r));
+			if (r.id >= VWL_IPC_SHM_WORKSPACES)
+				continue;
+			ws = &state.workspaces[r.id];
+			ws->listed = !r.removed;
+			ws->output = r.output;
+			ws->visible = r.visible;
+			ws->focused = r.focused;
+			ws->urgent = r.urgent;
+			frame_string(frame, r.name, ws->name, sizeof(ws->name));
+			if (!ws->name[0])
+				snprintf(ws->name, sizeof(ws->name), "%u", r.id);
+		}
+	}
+}
+
+/* Index of the output the bar shows, the focused one without a name; -1 if it is not there. */
+static int
+target_output(const char *name)
+{
+	int i;
+
+	for (i = 0; i < BAR_OUTPUTS; i++) {
+		const struct BarOutput *out = &state.outputs[i];
+
+		if (out->present && (name ? !strcmp(out->name, name) : out->focused))
+			return i;
+	}
+	return -1;
+}
+
+static void
+render_workspaces(JsonBuf *text, JsonBuf *tooltip, int output, bool *urgent)
+{
+	const struct BarWorkspace *ws;
+	char label[BAR_NAME_LEN + 3];
+	int n = 0;
+	size_t i;
+
+	for (i = 0; i < VWL_IPC_SHM_WORKSPACES; i++) {
+		ws = &state.workspaces[i];
+		if (!ws->listed || ws->output != output)
+			continue;
+		if (ws->focused)
+			snprintf(label, sizeof(label), "[%s]", ws->name);
+		else if (ws->urgent)
+			snprintf(label, sizeof(label), "!%s", ws->name);
+		else if (ws->visible)
+			snprintf(label, sizeof(label), "(%s)", ws->name);
+		else
+			snprintf(label, sizeof(label), "%s", ws->name);
+		if (n++) {
+			json_write_char(text, ' ');
+			json_write_char(tooltip, '\n');
+		}
+		json_write_str(text, label);
+		json_write_str(tooltip, ws->name);
+		if (ws->focused)
+			json_write_str(tooltip, " focused");
+		else if (ws->visible)
+			json_write_str(tooltip, " visible");
+		if (ws->urgent)
+			json_write_str(tooltip, " urgent");
+		*urgent |= ws->urgent;
+	}
+}
+
+/*
+ * Builds the Waybar custom module line for the current state into buf, using
+ * text and tooltip as scratch.
+ */
+static void
+render(JsonBuf *buf, JsonBuf *text, JsonBuf *tooltip, int module, const char *output_name)
+{
+	int output = target_output(output_name);
+	const struct BarOutput *out = output >= 0 ? &state.outputs[output] : NULL;
+	const struct BarVout *vout;
+	const char *class = NULL;
+	bool urgent = false;
+
+	json_buf_reset(text);
+	json_buf_reset(tooltip);
+	if (out && module == MODULE_WORKSPACES) {
+		render_workspaces(text, tooltip, output, &urgent);
+		class = urgent ? "urgent" : NULL;
+	} else if (out && module == MODULE_LAYOUT) {
+		if (out->active_vout >= 0 && (vout = find_vout((uint32_t)out->active_vout, false))) {
+			json_write_str(text, vout->layout);
+			json_write_str(tooltip, vout->name);
+		}
+	} else if (out && module == MODULE_TITLE && out->window) {
+		json_write_str(text, out->title);
+		json_write_str(tooltip, out->appid);
+		class = out->fullscreen ? "fullscreen" : out->tabbed ? "tabbed" : NULL;
+	}
+
+	json_buf_reset(buf);
+	json_write_str(buf, "{\"text\":");
+	json_write_escaped(buf, json_buf_str(text));
+	json_write_str(buf, ",\"tooltip\":");
+	json_write_escaped(buf, json_buf_str(tooltip));
+	if (!out || !text->len)
+		class = "empty";
+	if (class) {
+		json_write_str(buf, ",\"class\":");
+		json_write_escaped(buf, class);
+	}
+	json_write_str(buf, "}\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *socket_path = NULL;
+	const char *output_name = NULL;
+	char socket_buf[PATH_MAX];
+	JsonBuf line = {0}, last = {0}, text = {0}, tooltip = {0};
+	char *frame = NULL;
+	size_t frame_cap = 0;
+	char *reply = NULL;
+	size_t reply_cap = 0;
+	const struct VwlIpcFrame *hdr;
+	FILE *fp;
+	int module, argi = 1, fd, n;
+
+	for (; argi + 1 < argc && argv[argi][0] == '-'; argi += 2) {
+		if (!strcmp(argv[argi], "--socket")) {
+			socket_path = argv[argi + 1];
+		} else if (!strcmp(argv[argi], "--output")) {
+			output_name = argv[argi + 1];
+		} else {
+			usage(stderr);
+			return 1;
+		}
+	}
+	if (argi + 1 != argc) {
+		usage(stderr);
+		return 1;
+	}
+	for (module = 0; module < (int)(sizeof(module_names) / sizeof(module_names[0])); module++) {
+		if (!strcmp(argv[argi], module_names[module]))
+			break;
+	}
+	if (module == (int)(sizeof(module_names) / sizeof(module_names[0]))) {
+		usage(stderr);
+		return 1;
+	}
+
+	if (!socket_path && !(socket_path = vwl_ipc_socket_path(socket_buf, sizeof(socket_buf)))) {
+		if (errno == ENAMETOOLONG)
+			die("vwl-bar: socket path too long");
+		die("vwl-bar: XDG_RUNTIME_DIR must be set or VWL_SOCKET provided");
+	}
+
+	/* one binary delta subscription: only changed records arrive, and nothing needs parsing */
+	if ((fd = vwl_ipc_connect(socket_path)) < 0)
+		die("vwl-bar: connect %s:", socket_path);
+	if (!(fp = fdopen(fd, "r+")))
+		die("vwl-bar: fdopen:");
+	fprintf(fp, "{\"id\":0,\"type\":\"hello\",\"protocol\":\"binary\"}\n"
+		    "{\"id\":1,\"type\":\"subscribe\",\"mode\":\"delta\",\"topics\":%s}\n",
+			module_topics[module]);
+	fflush(fp);
+	if (getline(&reply, &reply_cap, fp) < 0)
+		die("vwl-bar: no reply from compositor");
+	if (!strstr(reply, "\"ok\":true"))
+		die("vwl-bar: %s", reply);
+	free(reply);
+
+	while ((n = vwl_ipc_read_frame(fp, &frame, &frame_cap)) > 0) {
+		hdr = (const struct VwlIpcFrame *)(const void *)frame;
+		if (hdr->type == VWL_IPC_FRAME_REPLY) {
+			if (!strstr(frame + hdr->strings, "\"ok\":true"))
+				die("vwl-bar: %s", frame + hdr->strings);
+			continue;
+		}
+		apply_frame(frame);
+		/* most events touch nothing this module shows, so only a different line is written */
+		render(&line, &text, &tooltip, module, output_name);
+		if (line.len == last.len && !memcmp(line.data, last.data, line.len))
+			continue;
+		fwrite(line.data, 1, line.len, stdout);
+		fflush(stdout);
+		json_buf_reset(&last);
+		json_write(&last, line.data, line.len);
+	}
+	if (n < 0)
+		die("vwl-bar: read frame:");
+
+	free(frame);
+	json_buf_finish(&line);
+	json_buf_finish(&last);
+	json_buf_finish(&text);
+	json_buf_finish(&tooltip);
+	fclose(fp);
+	die("vwl-bar: compositor closed the connection");
+	return 1;
+}
@@ -103,6 +103,7 @@ void moveresize(const Arg *arg);
 static void setfloating(Client *c, int floating);
 void togglefloating(const Arg *arg);
 void arrange(Monitor *m);
+static void arrangedone(const struct timespec *start);
 void axisnotify(struct wl_listener *listener, void *data);
 void buttonpress(struct wl_listener *listener, void *data);
 void chvt(const Arg *arg);
@@ -170,6 +171,7 @@ static void run(const char *startup_cmd);
 void setcursor(struct wl_listener *listener, void *data);
 void setcursorshape(struct wl_listener *listener, void *data);
 static void setfullscreen(Client *c, int fullscreen);
+static void seturgent(Client *c, int urgent);
 void setlayout(const Arg *arg);
 void setmfact(const Arg *arg);
 void setworkspace(Client *c, Workspace *ws);
@@ -211,16 +213,19 @@ static Workspace *wsfirst(VirtualOutput *vout);
 static VirtualOutput *firstvout(Monitor *m);
 VirtualOutput *findvoutbyname(Monitor *m, const char *name);
 static void wsmoveto(Workspace *ws, VirtualOutput *vout);
+static void wscount(Client *c, int sign);
 VirtualOutput *voutat(Monitor *m, double lx, double ly);
 void arrangevout(Monitor *m, const struct wlr_box *usable_area);
 static Workspace *wsnext(VirtualOutput *vout, Workspace *exclude);
 static void wssave(VirtualOutput *vout);
 static void wsload(VirtualOutput *vout, Workspace *ws);
 static Client *focustopvout(VirtualOutput *vout);
-static Client *focustoptiledvout(VirtualOutput *vout);
+static void voutsetlayout(VirtualOutput *vout, const Layout *lt);
 static void cursorwarptovout(VirtualOutput *vout);
 static int pointer_reveal_edge_for_cursor(Monitor *m, int current_edge);
 static void update_pointer_reveal_state(void);
+static void clientidalloc(Client *c);
+static void clientidfree(Client *c);
 /* removed unused voname function */
 
 /* variables */
@@ -247,6 +252,26 @@ static struct wlr_box sgeom;
 static bool vt_recovery_mode = false; /* Track if we're recovering from VT switch */
 static const int pointer_reveal_trigger_px = 2;
 static const int pointer_reveal_hold_px = 40;
+static Monitor *pointer_reveal_mon; /* monitor the last published reveal state was computed on */
+static int ipc_batching; /* nesting of ipc_batch_begin() */
+static int ipc_batch_focus; /* focusclient() was deferred by the batch */
+static VirtualOutput *ipc_batch_warp; /* last cursor warp deferred by the batch */
+
+/*
+ * Client ids are handles into client_slots: the low CLIENT_ID_INDEX_BITS pick the
+ * slot and the rest are its generation, bumped whenever the slot is freed, so the
+ * id of a destroyed client never finds the one that took its slot over.
+ */
+#define CLIENT_ID_INDEX_BITS 16
+#define CLIENT_ID_INDEX_MASK ((1u << CLIENT_ID_INDEX_BITS) - 1)
+typedef struct ClientSlot {
+	Client *c; /* NULL while free */
+	unsigned int gen; /* 1 up to CLIENT_ID_INDEX_MASK, so no id is 0 */
+	unsigned int next_free; /* while free, index of the next free slot or nclient_slots */
+} ClientSlot;
+static ClientSlot *client_slots;
+static unsigned int nclient_slots, client_slots_cap;
+static unsigned int client_slot_free; /* head of the free list, nclient_slots if empty */
 
 /* Global event handlers are now in plumbing.c */
 extern struct wl_listener cursor_axis;
@@ -316,6 +341,20 @@ tabhdr_style(void)
 	return &tabhdr_style_data;
 }
 
+static const struct IPCConfig ipc_config_data = {
+		.outbound_limit = ipc_outbound_limit,
+		.slow_policy = ipc_slow_policy,
+		.max_request = ipc_max_request,
+		.history = ipc_history,
+		.fanout_batch = ipc_fanout_batch,
+};
+
+const struct IPCConfig *
+ipc_config(void)
+{
+	return &ipc_config_data;
+}
+
 /* function implementations */
 void
 applybounds(Client *c, struct wlr_box *bbox)
@@ -386,15 +425,24 @@ applyrules(Client *c)
 	setworkspace(c, ws);
 }
 
+/* Upper bounds of the arrange() duration histogram buckets, in microseconds. */
+const unsigned int arrange_bucket_us[ARRANGE_BUCKETS - 1] = {50, 100, 250, 500, 1000, 2500, 10000};
+
 void
 arrange(Monitor *m)
 {
 	Client *c, *fs_client;
 	VirtualOutput *vout;
 	VirtualOutput *prev_focus = focusedvout(m);
+	struct timespec start;
 
 	if (!m->wlr_output->enabled)
 		return;
+	if (ipc_batching) {
+		m->arrange_pending = 1;
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	wl_list_for_each(c, &clients, link) {
 		if (c->mon == m) {
@@ -403,6 +451,8 @@ arrange(Monitor *m)
 			if (!c->isfullscreen && !client_is_unmanaged(c))
 				wlr_scene_node_reparent(
 						&c->scene->node, c->isfloating ? layers[LyrTop] : layers[LyrTile]);
+			/* visibility may change without a resize */
+			ipc_geometry_changed(c);
 		}
 	}
 
@@ -442,8 +492,29 @@ arrange(Monitor *m)
 		}
 	}
 	m->focus_vout = prev_focus ? prev_focus : firstvout(m);
+	ipc_mark_dirty();
 	motionnotify(0, NULL, 0, 0, 0, 0);
 	checkidleinhibitor(NULL);
+	arrangedone(&start);
+}
+
+/* Account an arrange() call that started at `start` in the metrics. */
+static void
+arrangedone(const struct timespec *start)
+{
+	struct timespec now;
+	unsigned long ns;
+	size_t i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (unsigned long)(now.tv_sec - start->tv_sec) * 1000000000UL + (unsigned long)now.tv_nsec -
+			(unsigned long)start->tv_nsec;
+	metrics.arranges++;
+	metrics.arrange_ns += ns;
+	i = 0;
+	while (i < LENGTH(arrange_bucket_us) && ns > arrange_bucket_us[i] * 1000UL)
+		i++;
+	metrics.arrange_buckets[i]++;
 }
 
 void
@@ -465,6 +536,9 @@ cleanupmon(struct wl_listener *listener, void *data)
 	if (m->lock_surface)
 		destroylocksurface(&m->destroy_lock_surface, NULL);
 	m->wlr_output->data = NULL;
+	if (pointer_reveal_mon == m)
+		pointer_reveal_mon = NULL;
+	ipc_output_destroyed(m);
 	wlr_output_layout_remove(output_layout, m->wlr_output);
 	wlr_scene_output_destroy(m->scene_output);
 
@@ -880,6 +954,9 @@ createnotify(struct wl_listener *listener, void *data)
 	c = toplevel->base->data = ecalloc(1, sizeof(*c));
 	c->surface.xdg = toplevel->base;
 	c->bw = 0;
+	clientidalloc(c);
+	c->ipc_visible = -1;
+	wl_list_init(&c->ipc_geom_link);
 
 	LISTEN(&toplevel->base->surface->events.commit, &c->commit, commitnotify);
 	LISTEN(&toplevel->base->surface->events.map, &c->map, mapnotify);
@@ -989,9 +1066,13 @@ destroynotify(struct wl_listener *listener, void *data)
 	if (c->image_capture_source) {
 		wl_list_remove(&c->image_capture_source_destroy.link);
 		wl_list_init(&c->image_capture_source_destroy.link);
+		wl_list_remove(&c->image_capture_frame.link);
+		wl_list_init(&c->image_capture_frame.link);
 		c->image_capture_source = NULL;
 	}
 	share_destroy(c);
+	clientidfree(c);
+	wl_list_remove(&c->ipc_geom_link);
 	wl_list_remove(&c->destroy.link);
 	wl_list_remove(&c->set_title.link);
 	wl_list_remove(&c->fullscreen.link);
@@ -1170,6 +1251,10 @@ cursorwarptovout(VirtualOutput *vout)
 
 	if (!enable_cursor_warp_to_vout || !cursor || !vout || !vout->mon)
 		return;
+	if (ipc_batching) {
+		ipc_batch_warp = vout;
+		return;
+	}
 	area = !wlr_box_empty(&vout->layout_geom) ? vout->layout_geom : vout->mon->window_area;
 	if (wlr_box_empty(&area))
 		return;
@@ -1191,6 +1276,11 @@ focusclient(Client *c, int lift)
 
 	if (locked)
 		return;
+	if (ipc_batching) {
+		/* ipc_batch_end() focuses the top client of whatever vout ends up selected */
+		ipc_batch_focus = 1;
+		return;
+	}
 
 	/* Raise client in stacking order if requested */
 	if (c && lift) {
@@ -1228,7 +1318,7 @@ focusclient(Client *c, int lift)
 											   : selvout->mon->window_area;
 			tabhdr_update(selvout->mon, selvout, area, focustoptiledvout(selvout));
 		}
-		c->isurgent = 0;
+		seturgent(c, 0);
 
 		/* Don't change border color if there is an exclusive focus or we are
 		 * handling a drag operation */
@@ -1503,6 +1593,7 @@ mapnotify(struct wl_listener *listener, void *data)
 	/* Insert this client into client lists. */
 	wl_list_insert(clients.prev, &c->link);
 	wl_list_insert(&fstack, &c->flink);
+	wscount(c, 1);
 	share_create_toplevel(c);
 
 	/* Set initial workspace and focus:
@@ -1519,6 +1610,7 @@ mapnotify(struct wl_listener *listener, void *data)
 	if (vt_recovery_mode && c->ws)
 		vt_recovery_mode = false;
 	updateipc();
+	ipc_wait_mapped(c);
 
 unset_fullscreen:
 	m = c->mon ? c->mon : xytomon(c->geom.x, c->geom.y);
@@ -1596,7 +1688,7 @@ pointer_reveal_edge_for_cursor(Monitor *m, int current_edge)
 static void
 update_pointer_reveal_state(void)
 {
-	Monitor *m;
+	Monitor *m = NULL;
 	int next_edge = POINTER_REVEAL_EDGE_NONE;
 	int next_hover = 0;
 
@@ -1605,10 +1697,12 @@ update_pointer_reveal_state(void)
 		next_edge = pointer_reveal_edge_for_cursor(m, ipc_pointer_reveal_edge);
 	}
 	next_hover = next_edge != POINTER_REVEAL_EDGE_NONE;
+	updatelayerreveal(m, next_edge);
 
-	if (next_hover == ipc_pointer_reveal_hover && next_edge == ipc_pointer_reveal_edge)
+	if (m == pointer_reveal_mon && next_hover == ipc_pointer_reveal_hover && next_edge == ipc_pointer_reveal_edge)
 		return;
 
+	pointer_reveal_mon = m;
 	ipc_pointer_reveal_hover = next_hover;
 	ipc_pointer_reveal_edge = next_edge;
 	updateipc();
@@ -1696,6 +1790,9 @@ motionnotify(uint32_t time, struct wlr_input_device *device, double dx, double d
 
 		/* Update selmon (even while dragging a window) */
 		if (sloppyfocus) {
+			VirtualOutput *prev_vout = selvout;
+			Monitor *prev_selmon = selmon;
+
 			selmon = hover_mon;
 			if (selmon) {
 				if (hover_vout)
@@ -1703,6 +1800,8 @@ motionnotify(uint32_t time, struct wlr_input_device *device, double dx, double d
 				selvout = hover_vout ? hover_vout : focusedvout(selmon);
 				selws = selvout ? selvout->ws : NULL;
 			}
+			if (selmon != prev_selmon || selvout != prev_vout)
+				updateipc();
 		}
 	}
 
@@ -1814,6 +1913,7 @@ resize(Client *c, struct wlr_box geo, int interact)
 	c->resize = client_set_size(c, c->geom.width - 2 * c->bw, c->geom.height - 2 * c->bw);
 	client_get_clip(c, &clip);
 	wlr_scene_subsurface_tree_set_clip(&c->scene_surface->node, &clip);
+	ipc_geometry_changed(c);
 }
 
 void
@@ -1955,19 +2055,7 @@ setfullscreen(Client *c, int fullscreen)
 void
 setlayout(const Arg *arg)
 {
-	VirtualOutput *vout = focusedvout(selmon);
-
-	if (!vout)
-		return;
-	if (!arg || !arg->v || arg->v != vout->lt[vout->sellt])
-		vout->sellt ^= 1;
-	if (arg && arg->v)
-		vout->lt[vout->sellt] = (Layout *)arg->v;
-	strncpy(vout->ltsymbol, vout->lt[vout->sellt]->symbol, LENGTH(vout->ltsymbol));
-	vout->ltsymbol[LENGTH(vout->ltsymbol) - 1] = '\0';
-	wssave(vout);
-	arrange(selmon);
-	updateipc();
+	voutsetlayout(focusedvout(selmon), arg ? arg->v : NULL);
 }
 
 /* arg > 1.0 will set mfact absolutely */
@@ -1987,6 +2075,17 @@ setmfact(const Arg *arg)
 	arrange(selmon);
 }
 
+void
+seturgent(Client *c, int urgent)
+{
+	urgent = !!urgent;
+	if (c->isurgent == urgent)
+		return;
+	wscount(c, -1);
+	c->isurgent = urgent;
+	wscount(c, 1);
+}
+
 void
 setworkspace(Client *c, Workspace *ws)
 {
@@ -1998,7 +2097,10 @@ setworkspace(Client *c, Workspace *ws)
 	if (!workspace_changed && oldmon == newmon)
 		return;
 
+	ipc_mark_dirty();
+	wscount(c, -1);
 	c->ws = ws;
+	wscount(c, 1);
 	c->mon = newmon;
 	c->prev = c->geom;
 
@@ -2519,6 +2621,7 @@ unmapnotify(struct wl_listener *listener, void *data)
 	}
 	share_destroy_capture_scene(c);
 	share_destroy(c);
+	ipc_geometry_unmapped(c);
 
 	if (client_is_unmanaged(c)) {
 		if (c == exclusive_focus) {
@@ -2527,6 +2630,7 @@ unmapnotify(struct wl_listener *listener, void *data)
 		}
 	} else {
 		Monitor *m = c->mon;
+		wscount(c, -1);
 		wl_list_remove(&c->link);
 		wl_list_remove(&c->flink);
 		/* Preserve workspace during VT recovery or when vout is NULL */
@@ -2681,6 +2785,9 @@ updatetitle(struct wl_listener *listener, void *data)
 	else
 		area = m->window_area;
 	tabhdr_update(m, vout, area, focustoptiledvout(vout));
+	/* zvwl_ipc_output_v1 lists every tab */
+	if (c != focustop(c->mon))
+		updateipc();
 }
 
 void
@@ -2692,7 +2799,7 @@ urgent(struct wl_listener *listener, void *data)
 	if (!c || c == focustop(selmon))
 		return;
 
-	c->isurgent = 1;
+	seturgent(c, 1);
 	updateipc();
 
 	if (client_surface(c)->mapped)
@@ -2832,6 +2939,56 @@ wsbyid(unsigned int id)
 	return id < WORKSPACE_COUNT ? &workspaces[id] : NULL;
 }
 
+/* Gives c an id; it stays 0, and c unreachable by id, if every slot is taken. */
+static void
+clientidalloc(Client *c)
+{
+	ClientSlot *slots;
+	unsigned int i = client_slot_free;
+
+	if (i == nclient_slots) {
+		if (nclient_slots > CLIENT_ID_INDEX_MASK)
+			return;
+		if (nclient_slots == client_slots_cap) {
+			client_slots_cap = MIN(MAX(client_slots_cap * 2, 64), CLIENT_ID_INDEX_MASK + 1);
+			if (!(slots = realloc(client_slots, client_slots_cap * sizeof(*slots))))
+				die("realloc:");
+			client_slots = slots;
+		}
+		client_slots[i].gen = 1;
+		client_slot_free = ++nclient_slots;
+	} else {
+		client_slot_free = client_slots[i].next_free;
+	}
+	client_slots[i].c = c;
+	c->id = client_slots[i].gen << CLIENT_ID_INDEX_BITS | i;
+}
+
+static void
+clientidfree(Client *c)
+{
+	ClientSlot *slot;
+
+	if (!c->id)
+		return;
+	slot = &client_slots[c->id & CLIENT_ID_INDEX_MASK];
+	slot->c = NULL;
+	slot->gen = slot->gen == CLIENT_ID_INDEX_MASK ? 1 : slot->gen + 1;
+	slot->next_free = client_slot_free;
+	client_slot_free = (unsigned int)(slot - client_slots);
+	c->id = 0;
+}
+
+Client *
+clientbyid(unsigned int id)
+{
+	unsigned int i = id & CLIENT_ID_INDEX_MASK;
+
+	if (i >= nclient_slots || client_slots[i].gen != id >> CLIENT_ID_INDEX_BITS)
+		return NULL;
+	return client_slots[i].c;
+}
+
 static VirtualOutput *
 firstvout(Monitor *m)
 {
@@ -2899,6 +3056,47 @@ ipc_set_workspace_by_id(unsigned int workspace_id)
 	return 0;
 }
 
+int
+ipc_focus_client(Client *c)
+{
+	if (!c || client_is_unmanaged(c) || !c->ws)
+		return -1;
+	if (c->ws != selws)
+		view(&(Arg){.ui = c->ws->id});
+	if (!c->ws->vout)
+		return -1;
+	/* a batch focuses the top of the focus stack when it ends */
+	wl_list_remove(&c->flink);
+	wl_list_insert(&fstack, &c->flink);
+	focusclient(c, 1);
+	updateipc();
+	return 0;
+}
+
+int
+ipc_move_client_to_workspace(Client *c, Workspace *ws)
+{
+	VirtualOutput *vout;
+
+	if (!c || client_is_unmanaged(c) || !ws)
+		return -1;
+	/* like tag(), a workspace without a vout is put on the focused one */
+	if (!ws->vout && (vout = focusedvout(selmon)))
+		wsattach(vout, ws);
+	setworkspace(c, ws);
+	updateipc();
+	return 0;
+}
+
+int
+ipc_close_client(Client *c)
+{
+	if (!c || client_is_unmanaged(c))
+		return -1;
+	client_send_close(c);
+	return 0;
+}
+
 int
 ipc_focus_virtual_output(VirtualOutput *vout)
 {
@@ -2938,6 +3136,53 @@ ipc_move_workspace_to_vout(Workspace *ws, VirtualOutput *vout)
 	return 0;
 }
 
+/* Symbol of layouts[index], or NULL past the last one. */
+const char *
+ipc_layout_symbol(unsigned int index)
+{
+	return index < LENGTH(layouts) ? layouts[index].symbol : NULL;
+}
+
+int
+ipc_set_layout(VirtualOutput *vout, unsigned int index)
+{
+	if (!vout || index >= LENGTH(layouts))
+		return -1;
+	voutsetlayout(vout, &layouts[index]);
+	return 0;
+}
+
+void
+ipc_batch_begin(void)
+{
+	ipc_batching++;
+}
+
+/* Applies what the commands of a batch deferred: one arrange per touched monitor, one focus change and one warp. */
+void
+ipc_batch_end(void)
+{
+	Monitor *m;
+	VirtualOutput *warp = ipc_batch_warp;
+
+	if (--ipc_batching > 0)
+		return;
+	ipc_batch_warp = NULL;
+	wl_list_for_each(m, &mons, link) {
+		if (m->arrange_pending) {
+			m->arrange_pending = 0;
+			arrange(m);
+		}
+	}
+	if (ipc_batch_focus) {
+		ipc_batch_focus = 0;
+		focusclient(focustopvout(selvout), 1);
+	}
+	if (warp)
+		cursorwarptovout(warp);
+	updateipc();
+}
+
 VirtualOutput *
 focusedvout(Monitor *m)
 {
@@ -3107,7 +3352,7 @@ focustopvout(VirtualOutput *vout)
 	return NULL;
 }
 
-static Client *
+Client *
 focustoptiledvout(VirtualOutput *vout)
 {
 	Client *c;
@@ -3214,6 +3459,24 @@ wsload(VirtualOutput *vout, Workspace *ws)
 	vout->ltsymbol[LENGTH(vout->ltsymbol) - 1] = '\0';
 }
 
+/* setlayout() for any virtual output: switches to lt, or toggles between its two layouts if lt is NULL. */
+static void
+voutsetlayout(VirtualOutput *vout, const Layout *lt)
+{
+	if (!vout)
+		return;
+	if (!lt || lt != vout->lt[vout->sellt])
+		vout->sellt ^= 1;
+	if (lt)
+		vout->lt[vout->sellt] = lt;
+	strncpy(vout->ltsymbol, vout->lt[vout->sellt]->symbol, LENGTH(vout->ltsymbol));
+	vout->ltsymbol[LENGTH(vout->ltsymbol) - 1] = '\0';
+	wssave(vout);
+	if (vout->mon)
+		arrange(vout->mon);
+	updateipc();
+}
+
 static Workspace *
 wsfirst(VirtualOutput *vout)
 {
@@ -3268,6 +3531,7 @@ wsactivate(VirtualOutput *vout, Workspace *ws, int focus_change)
 	/* char vbuf[64]; - unused */
 	if (!vout)
 		return;
+	ipc_mark_dirty();
 	m = vout->mon;
 	if (m)
 		m->focus_vout = vout;
@@ -3334,6 +3598,21 @@ wsmoveto(Workspace *ws, VirtualOutput *vout)
 	}
 }
 
+/*
+ * Adds (sign 1) or removes (sign -1) c from the counters of its workspace. Only
+ * clients on the clients list count; wl_list_remove() clears the link of one
+ * that was unmapped.
+ */
+void
+wscount(Client *c, int sign)
+{
+	if (!c->ws || !c->link.next)
+		return;
+	c->ws->nclients += (unsigned int)sign;
+	if (c->isurgent)
+		c->ws->nurgent += (unsigned int)sign;
+}
+
 #ifdef XWAYLAND
 void
 activatex11(struct wl_listener *listener, void *data)
@@ -3394,6 +3673,9 @@ createnotifyx11(struct wl_listener *listener, void *data)
 	c->surface.xwayland = xsurface;
 	c->type = X11;
 	c->bw = 0;
+	clientidalloc(c);
+	c->ipc_visible = -1;
+	wl_list_init(&c->ipc_geom_link);
 
 	/* Listen to the various events it can emit */
 	LISTEN(&xsurface->events.associate, &c->associate, associatex11);
@@ -3422,7 +3704,7 @@ sethints(struct wl_listener *listener, void *data)
 	if (c == focustop(selmon) || !c->surface.xwayland->hints)
 		return;
 
-	c->isurgent = xcb_icccm_wm_hints_get_urgency(c->surface.xwayland->hints);
+	seturgent(c, xcb_icccm_wm_hints_get_urgency(c->surface.xwayland->hints));
 	updateipc();
 
 	if (c->isurgent && surface && surface->mapped)
@@ -35,6 +35,7 @@
 #define END(A) ((A) + LENGTH(A))
 #define WORKSPACE_COUNT 256
 #define WORKSPACE_NAME_LEN 32
+#define ARRANGE_BUCKETS 8 /* arrange() duration histogram, see arrange_bucket_us */
 #define LISTEN(E, L, H) wl_signal_add((E), ((L)->notify = (H), (L)))
 #define LISTEN_STATIC(E, H)                                       \
 	do {                                                      \
@@ -97,7 +98,9 @@ typedef struct MonitorRule MonitorRule;
 typedef struct VirtualOutputRule VirtualOutputRule;
 typedef struct PointerConstraint PointerConstraint;
 typedef struct Rule Rule;
+typedef struct LayerRule LayerRule;
 typedef struct SessionLock SessionLock;
+typedef struct Metrics Metrics;
 typedef struct IPCOutput IPCOutput;
 typedef struct IPCManager IPCManager;
 struct wlr_ext_image_capture_source_v1;
@@ -130,6 +133,7 @@ struct Client {
 	struct wl_listener unmap;
 	struct wl_listener destroy;
 	struct wl_listener image_capture_source_destroy;
+	struct wl_listener image_capture_frame;
 	struct wl_listener set_title;
 	struct wl_listener fullscreen;
 	struct wl_listener set_decoration_mode;
@@ -141,6 +145,10 @@ struct Client {
 	struct wl_listener configure;
 	struct wl_listener set_hints;
 #endif
+	unsigned int id; /* names the client over IPC, see clientbyid() */
+	struct wl_list ipc_geom_link; /* ipc geometry watchers are owed an update, see ipc_geometry_changed() */
+	struct wlr_box ipc_geom;      /* what the watchers were last sent */
+	int ipc_vout, ipc_visible;    /* ipc_visible is -1 until the first update */
 	unsigned int bw;
 	Workspace *ws;
 	int isfloating, isurgent, isfullscreen;
@@ -179,6 +187,9 @@ struct LayerSurface {
 	struct wl_list link;
 	int mapped;
 	struct wlr_layer_surface_v1 *layer_surface;
+	int autohide;	 /* hidden until the pointer reaches reveal_edge */
+	int revealed;
+	int reveal_edge; /* POINTER_REVEAL_EDGE_*, taken from the anchor */
 
 	struct wl_listener destroy;
 	struct wl_listener unmap;
@@ -206,6 +217,8 @@ struct Workspace {
 	char orphan_vout_name[WORKSPACE_NAME_LEN];
 	char orphan_monitor_name[WORKSPACE_NAME_LEN];
 	bool was_orphaned; /* Track if workspace was orphaned during monitor removal */
+	unsigned int nclients; /* mapped clients on this workspace, see wscount() */
+	unsigned int nurgent; /* of which urgent */
 };
 
 struct VirtualOutput {
@@ -225,6 +238,7 @@ struct VirtualOutput {
 	const Layout *lt[2];
 	unsigned int sellt;
 	char ltsymbol[16];
+	unsigned long capture_frames; /* rendered for its capture source */
 	struct {
 		struct wl_signal destroy;
 	} events;
@@ -257,9 +271,12 @@ struct Monitor {
 	struct wl_list layers[4];    /* LayerSurface.link */
 	struct wl_list vouts;	     /* VirtualOutput.link */
 	VirtualOutput *focus_vout;
+	int arrange_pending; /* arrange() deferred by an IPC batch */
 	int gamma_lut_changed;
 	int asleep;
 	MonitorPhysical phys;
+	unsigned long frames_committed; /* by rendermon() */
+	unsigned long frames_skipped;	/* while a client resize was outstanding */
 };
 
 struct CursorPhysical {
@@ -316,6 +333,11 @@ struct Rule {
 	int monitor;
 };
 
+struct LayerRule {
+	const char *namespace;
+	int autohide;
+};
+
 struct SessionLock {
 	struct wlr_scene_tree *scene;
 	struct wlr_session_lock_v1 *lock;
@@ -324,6 +346,14 @@ struct SessionLock {
 	struct wl_listener destroy;
 };
 
+/* Counters served by the IPC get_metrics request; per-output ones live in Monitor and VirtualOutput. */
+struct Metrics {
+	unsigned long arranges;
+	unsigned long arrange_ns;
+	unsigned long arrange_buckets[ARRANGE_BUCKETS]; /* not cumulative, the last one is +Inf */
+	unsigned long toplevel_capture_frames;
+};
+
 /* Global variables - declarations (defined in plumbing.c) */
 extern struct wl_display *dpy;
 extern struct wl_event_loop *event_loop;
@@ -358,6 +388,8 @@ extern int locked;
 extern void *exclusive_focus;
 extern CursorPhysical cursor_phys;
 extern pid_t child_pid;
+extern Metrics metrics;
+extern const unsigned int arrange_bucket_us[ARRANGE_BUCKETS - 1];
 extern struct wlr_idle_notifier_v1 *idle_notifier;
 extern struct wlr_idle_inhibit_manager_v1 *idle_inhibit_mgr;
 extern struct wlr_pointer_constraint_v1 *active_constraint;
@@ -417,6 +449,7 @@ void cursorinteg(double dx, double dy);
 int cursorgap(Monitor *origin, double prev_mm_x, double prev_mm_y);
 void destroylock(SessionLock *lock, int unlock);
 void arrangelayer(Monitor *m, struct wl_list *list, struct wlr_box *usable_area, int exclusive);
+void updatelayerreveal(Monitor *pointer_mon, int edge);
 
 /* Functions needed by plumbing.c from vwl.c */
 void cursorsync(void);
@@ -425,6 +458,7 @@ void motionnotify(uint32_t time, struct wlr_input_device *device, double dx, dou
 		double dy_unaccel);
 void focusclient(Client *c, int lift);
 Client *focustop(Monitor *m);
+Client *focustoptiledvout(VirtualOutput *vout);
 void arrangelayers(Monitor *m);
 void arrangevout(Monitor *m, const struct wlr_box *usable_area);
 void arrange(Monitor *m);
@@ -440,12 +474,20 @@ void quit(const Arg *arg);
 VirtualOutput *focusedvout(Monitor *m);
 Monitor *monitorbyname(const char *name);
 Workspace *wsbyid(unsigned int id);
+Client *clientbyid(unsigned int id);
 VirtualOutput *voutbyid(unsigned int id);
 VirtualOutput *findvoutbyname(Monitor *m, const char *name);
 void setworkspace(Client *c, Workspace *ws);
 int ipc_set_workspace_by_id(unsigned int workspace_id);
 int ipc_focus_virtual_output(VirtualOutput *vout);
+int ipc_focus_client(Client *c);
+int ipc_move_client_to_workspace(Client *c, Workspace *ws);
+int ipc_close_client(Client *c);
 int ipc_move_workspace_to_vout(Workspace *ws, VirtualOutput *vout);
+const char *ipc_layout_symbol(unsigned int index);
+int ipc_set_layout(VirtualOutput *vout, unsigned int index);
+void ipc_batch_begin(void);
+void ipc_batch_end(void);
 void configurephys(Monitor *m, const MonitorRule *match);
 void updatephys(Monitor *m);
 void wsattach(VirtualOutput *vout, Workspace *ws);
@@ -1,27 +1,57 @@
 #define _POSIX_C_SOURCE 200809L
 
+#include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
-#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "ipc.h"
+#include "ipcclient.h"
+#include "json.h"
 #include "util.h"
 
+#define REPL_MAX_WORDS 64
+#define REPL_MAX_PENDING 32 /* requests in flight before stdin is left unread */
+#define MAX_FIELDS 16
+
+/* What subscribe --field and --changes print, see print_fields(). */
+struct FieldFilter {
+	const char *paths[MAX_FIELDS];
+	int npaths;
+	bool changes; /* print only output that differs from the last */
+	char *last;
+	size_t last_len;
+};
+
 static void
 usage(FILE *fp)
 {
 	fprintf(fp, "usage: vwlctl [--socket PATH] <command> [args]\n"
 		    "\n"
 		    "commands:\n"
-		    "  get-state\n"
-		    "  subscribe\n"
+		    "  get-state [--binary | --shm | [--section KEY]... [--only-populated]]\n"
+		    "  get-stats\n"
+		    "  metrics\n"
+		    "  bench [--subscribers N] [--stalled N] [--clients N] [--rate HZ] [--duration SECONDS]\n"
+		    "        [--set-every N] [--workspaces N] [--delta] [--topic TOPIC]...\n"
+		    "  repl, --stdin\n"
+		    "  subscribe [--binary] [--delta [--since SEQ]] [--topic TOPIC]... [--section KEY]...\n"
+		    "            [--only-populated] [--max-hz HZ] [--field PATH]... [--changes]\n"
+		    "  watch-geometry [--none | CLIENT_ID...]\n"
 		    "  set-workspace WORKSPACE_ID\n"
+		    "  focus-client CLIENT_ID\n"
+		    "  move-client-to-workspace CLIENT_ID WORKSPACE_ID\n"
+		    "  close-client CLIENT_ID\n"
+		    "  wait-for (app APP_ID | workspace WORKSPACE_ID [--vout-id ID | --output NAME --vout NAME] |\n"
+		    "            output NAME) [--timeout MS]\n"
 		    "  spawn-on-workspace WORKSPACE_ID COMMAND\n"
 		    "  set-vout-focus (--vout-id ID | --output NAME --vout NAME)\n"
 		    "  move-workspace-to-vout WORKSPACE_ID (--vout-id ID | --output NAME --vout "
@@ -29,7 +59,7 @@ usage(FILE *fp)
 }
 
 static void
-json_write_escaped(FILE *fp, const char *value)
+json_fprint_escaped(FILE *fp, const char *value)
 {
 	const unsigned char *p = (const unsigned char *)(value ? value : "");
 
@@ -68,39 +98,13 @@ json_write_escaped(FILE *fp, const char *value)
 	fputc('"', fp);
 }
 
-static const char *
-default_socket_path(char *buf, size_t buf_sz)
-{
-	const char *socket = getenv("VWL_SOCKET");
-	const char *runtime_dir;
-
-	if (socket && *socket)
-		return socket;
-
-	runtime_dir = getenv("XDG_RUNTIME_DIR");
-	if (!runtime_dir || !*runtime_dir)
-		die("vwlctl: XDG_RUNTIME_DIR must be set or VWL_SOCKET provided");
-	if (snprintf(buf, buf_sz, "%s/%s", runtime_dir, VWL_IPC_SOCKET_NAME) >= (int)buf_sz)
-		die("vwlctl: socket path too long");
-	return buf;
-}
-
 static int
 connect_socket(const char *path)
 {
-	struct sockaddr_un addr;
-	int fd;
+	int fd = vwl_ipc_connect(path);
 
-	fd = socket(AF_UNIX, SOCK_STREAM, 0);
 	if (fd < 0)
-		die("vwlctl: socket:");
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sun_family = AF_UNIX;
-	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
-	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
 		die("vwlctl: connect %s:", path);
-
 	return fd;
 }
 
@@ -135,6 +139,290 @@ json_reply_ok(const char *line)
 	return -1;
 }
 
+static void
+print_frame_string(const char *frame, const struct VwlIpcFrame *hdr, struct VwlIpcString str)
+{
+	char *value;
+
+	if (str.len == VWL_IPC_NULL || str.offset > hdr->size - hdr->strings ||
+			str.len > hdr->size - hdr->strings - str.offset) {
+		fputs("null", stdout);
+		return;
+	}
+	value = strndup(frame + hdr->strings + str.offset, str.len);
+	if (!value)
+		die("vwlctl: strndup:");
+	json_fprint_escaped(stdout, value);
+	free(value);
+}
+
+static void
+print_frame_box(const char *name, const struct VwlIpcBox *box)
+{
+	printf(" %s=%d,%d,%dx%d", name, box->x, box->y, box->width, box->height);
+}
+
+static const char *
+frame_edge_name(uint8_t edge)
+{
+	static const char *const names[] = {"null", "top", "bottom", "left", "right"};
+
+	return edge < sizeof(names) / sizeof(names[0]) ? names[edge] : "null";
+}
+
+/* Prints the records of a state or event frame, one "state|event KIND key=value..." line each. */
+static void
+print_frame(const char *frame)
+{
+	const struct VwlIpcFrame *hdr = (const struct VwlIpcFrame *)(const void *)frame;
+	const char *type = hdr->type == VWL_IPC_FRAME_STATE ? "state" : "event";
+	const char *p = frame + sizeof(*hdr);
+	struct VwlIpcRecord rec;
+	unsigned int i;
+
+	for (i = 0; i < hdr->count; i++, p += rec.size) {
+		if ((size_t)(frame + hdr->strings - p) < sizeof(rec))
+			die("vwlctl: malformed frame");
+		memcpy(&rec, p, sizeof(rec));
+		if (rec.size < sizeof(rec) || (size_t)(frame + hdr->strings - p) < rec.size)
+			die("vwlctl: malformed frame");
+
+		if (rec.kind == VWL_IPC_RECORD_FOCUS && rec.size >= sizeof(struct VwlIpcFocus)) {
+			struct VwlIpcFocus r;
+
+			memcpy(&r, p, sizeof(r));
+			printf("%s focus output=%d vout=%d workspace=%d\n", type, r.output, r.vout, r.workspace);
+		} else if (rec.kind == VWL_IPC_RECORD_POINTER && rec.size >= sizeof(struct VwlIpcPointer)) {
+			struct VwlIpcPointer r;
+
+			memcpy(&r, p, sizeof(r));
+			printf("%s pointer output=%d reveal_hover=%u reveal_edge=%s\n", type, r.output, r.reveal_hover,
+					frame_edge_name(r.reveal_edge));
+		} else if (rec.kind == VWL_IPC_RECORD_OUTPUT && rec.size >= sizeof(struct VwlIpcOutput)) {
+			struct VwlIpcOutput r;
+
+			memcpy(&r, p, sizeof(r));
+			printf("%s output index=%d name=", type, r.index);
+			print_frame_string(frame, hdr, r.name);
+			printf(" focused=%u active_vout=%d", r.focused, r.active_vout);
+			print_frame_box("geometry", &r.geometry);
+			print_frame_box("workarea", &r.workarea);
+			putchar('\n');
+		} else if (rec.kind == VWL_IPC_RECORD_WINDOW && rec.size >= sizeof(struct VwlIpcWindow)) {
+			struct VwlIpcWindow r;
+
+			memcpy(&r, p, sizeof(r));
+			printf("%s window output=%d present=%u title=", type, r.output, r.present);
+			print_frame_string(frame, hdr, r.title);
+			fputs(" appid=", stdout);
+			print_frame_string(frame, hdr, r.appid);
+			printf(" fullscreen=%u floating=%u tabbed=%u\n", r.fullscreen, r.floating, r.tabbed);
+		} else if (rec.kind == VWL_IPC_RECORD_VOUT && rec.size >= sizeof(struct VwlIpcVout)) {
+			struct VwlIpcVout r;
+
+			memcpy(&r, p, sizeof(r));
+			printf("%s vout id=%u name=", type, r.id);
+			print_frame_string(frame, hdr, r.name);
+			printf(" output=%d focused=%u workspace=%d workspace_name=", r.output, r.focused, r.workspace);
+			print_frame_string(frame, hdr, r.workspace_name);
+			fputs(" layout=", stdout);
+			print_frame_string(frame, hdr, r.layout);
+			printf(" clients=%u urgent=%u removed=%u", r.clients, r.urgent, r.removed);
+			print_frame_box("geometry", &r.geometry);
+			putchar('\n');
+		} else if (rec.kind == VWL_IPC_RECORD_WORKSPACE && rec.size >= sizeof(struct VwlIpcWorkspace)) {
+			struct VwlIpcWorkspace r;
+
+			memcpy(&r, p, sizeof(r));
+			printf("%s workspace id=%u name=", type, r.id);
+			print_frame_string(frame, hdr, r.name);
+			printf(" assigned=%u visible=%u focused=%u clients=%u urgent=%u output=%d vout=%d vout_name=",
+					r.assigned, r.visible, r.focused, r.clients, r.urgent, r.output, r.vout);
+			print_frame_string(frame, hdr, r.vout_name);
+			printf(" removed=%u\n", r.removed);
+		}
+	}
+}
+
+/*
+ * Speaks the binary protocol after hello: prints reply frames as their JSON text
+ * and the records of state and event frames. get-state stops after its state
+ * frame; a subscription runs until the compositor goes away.
+ */
+static int
+run_binary(FILE *fp, bool subscribe)
+{
+	char *reply = read_line(fp);
+	char *frame = NULL;
+	size_t frame_cap = 0;
+	int status = -1, n;
+
+	if (!reply)
+		die("vwlctl: no reply from compositor");
+	if (json_reply_ok(reply) != 1) {
+		puts(reply);
+		free(reply);
+		return 1;
+	}
+	free(reply);
+
+	while ((n = vwl_ipc_read_frame(fp, &frame, &frame_cap)) > 0) {
+		const struct VwlIpcFrame *hdr = (const struct VwlIpcFrame *)(const void *)frame;
+		bool state = hdr->type == VWL_IPC_FRAME_STATE;
+
+		if (hdr->type == VWL_IPC_FRAME_REPLY) {
+			puts(frame + hdr->strings);
+			status = json_reply_ok(frame + hdr->strings);
+		} else {
+			print_frame(frame);
+		}
+		fflush(stdout);
+		/* a rejected request gets no state, and get-state is done once it has it */
+		if (status == 0 || (state && !subscribe))
+			break;
+	}
+	if (n < 0)
+		die("vwlctl: read frame:");
+	free(frame);
+	return status == 1 ? 0 : 1;
+}
+
+/* Reads the one-line reply to get_state_fd along with the fd passed with it. */
+static char *
+read_line_fd(int fd, int *passed)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char *line = NULL;
+	size_t len = 0, cap = 0;
+	ssize_t n;
+
+	*passed = -1;
+	while (!len || line[len - 1] != '\n') {
+		if (cap - len < 256) {
+			cap = cap ? cap * 2 : 512;
+			line = realloc(line, cap);
+			if (!line)
+				die("vwlctl: realloc:");
+		}
+		iov.iov_base = line + len;
+		iov.iov_len = cap - len - 1;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			die("vwlctl: recvmsg:");
+		if (n == 0)
+			die("vwlctl: no reply from compositor");
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && *passed < 0)
+				memcpy(passed, CMSG_DATA(cmsg), sizeof(int));
+		}
+		len += (size_t)n;
+	}
+	line[len - 1] = '\0';
+	return line;
+}
+
+/* Copies the state page under its seqlock, see VwlIpcShmState. */
+static void
+read_shm(const struct VwlIpcShmState *page, struct VwlIpcShmState *out)
+{
+	unsigned long tries;
+	uint32_t seq;
+
+	for (tries = 0; tries < 1000000; tries++) {
+		seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(out, page, sizeof(*out));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq)
+			return;
+	}
+	die("vwlctl: state page is not settling");
+}
+
+/* Maps the state page passed with the reply and prints it like a binary state frame. */
+static int
+run_shm(int fd)
+{
+	const struct VwlIpcShmState *page;
+	struct VwlIpcShmState *st;
+	char *reply;
+	int shm_fd;
+	unsigned int i;
+
+	reply = read_line_fd(fd, &shm_fd);
+	if (json_reply_ok(reply) != 1) {
+		puts(reply);
+		free(reply);
+		return 1;
+	}
+	free(reply);
+	if (shm_fd < 0)
+		die("vwlctl: no state page passed");
+
+	page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, shm_fd, 0);
+	if (page == MAP_FAILED)
+		die("vwlctl: mmap:");
+	close(shm_fd);
+	if (page->magic != VWL_IPC_SHM_MAGIC || page->version != VWL_IPC_SHM_VERSION || page->size != sizeof(*page))
+		die("vwlctl: unsupported state page");
+	st = malloc(sizeof(*st));
+	if (!st)
+		die("vwlctl: malloc:");
+	read_shm(page, st);
+	munmap((void *)page, sizeof(*page));
+
+	printf("state focus output=%d vout=%d workspace=%d\n", st->focused_output, st->focused_vout,
+			st->focused_workspace);
+	printf("state pointer output=%d reveal_hover=%u reveal_edge=%s\n", st->pointer_output, st->reveal_hover,
+			frame_edge_name(st->reveal_edge));
+	for (i = 0; i < st->noutputs && i < VWL_IPC_SHM_OUTPUTS; i++) {
+		const struct VwlIpcShmOutput *o = &st->outputs[i];
+
+		printf("state output index=%u name=", i);
+		json_fprint_escaped(stdout, o->name);
+		printf(" focused=%u active_vout=%d", o->focused, o->active_vout);
+		print_frame_box("geometry", &o->geometry);
+		print_frame_box("workarea", &o->workarea);
+		putchar('\n');
+	}
+	for (i = 0; i < st->nvouts && i < VWL_IPC_SHM_VOUTS; i++) {
+		const struct VwlIpcShmVout *v = &st->vouts[i];
+
+		printf("state vout id=%u name=", v->id);
+		json_fprint_escaped(stdout, v->name);
+		printf(" output=%d focused=%u workspace=%d clients=%u urgent=%u", v->output, v->focused, v->workspace,
+				v->clients, v->urgent);
+		print_frame_box("geometry", &v->geometry);
+		putchar('\n');
+	}
+	for (i = 0; i < VWL_IPC_SHM_WORKSPACES; i++) {
+		const struct VwlIpcShmWorkspace *w = &st->workspaces[i];
+
+		if (!w->listed)
+			continue;
+		printf("state workspace id=%u name=", i);
+		json_fprint_escaped(stdout, w->name);
+		printf(" assigned=%u visible=%u focused=%u clients=%u urgent=%u output=%d vout=%d\n", w->assigned,
+				w->visible, w->focused, w->clients, w->urgent, w->output, w->vout);
+	}
+	free(st);
+	return 0;
+}
+
 static void
 append_vout_ref(FILE *fp, int *needs_comma, const char *output_name, const char *vout_name, const char *vout_id)
 {
@@ -144,72 +432,301 @@ append_vout_ref(FILE *fp, int *needs_comma, const char *output_name, const char
 		return;
 	}
 
-	if (!output_name || !vout_name)
-		die("vwlctl: virtual output requires --vout-id or --output NAME --vout NAME");
-
 	fprintf(fp, "%s\"output\":", *needs_comma ? "," : "");
-	json_write_escaped(fp, output_name);
+	json_fprint_escaped(fp, output_name);
 	fputs(",\"vout_name\":", fp);
-	json_write_escaped(fp, vout_name);
+	json_fprint_escaped(fp, vout_name);
 	*needs_comma = 1;
 }
 
-int
-main(int argc, char *argv[])
+/* The top-level state key a --field path starts with, or NULL if there is none. */
+static const char *
+field_section(const char *path)
 {
-	char socket_buf[PATH_MAX];
-	const char *socket_path = NULL;
-	const char *cmd;
-	FILE *request_fp;
-	FILE *reply_fp;
-	char *request = NULL;
-	size_t request_sz = 0;
-	char *reply;
-	int fd;
-	int argi = 1;
-	int status;
+	static const char *const keys[] = {"focused_output", "focused_virtual_output", "focused_workspace", "pointer",
+			"outputs", "virtual_outputs", "workspaces"};
+	size_t len = strcspn(path, ".");
+	size_t i;
 
-	while (argi < argc && !strcmp(argv[argi], "--socket")) {
-		if (argi + 1 >= argc) {
-			usage(stderr);
-			return 1;
-		}
-		socket_path = argv[argi + 1];
-		argi += 2;
+	for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+		if (strlen(keys[i]) == len && !strncmp(path, keys[i], len))
+			return keys[i];
 	}
+	return NULL;
+}
 
-	if (argi >= argc) {
-		usage(stderr);
-		return 1;
-	}
+/* Writes one more name of a request's list, opening the list with the first. */
+static void
+append_name(FILE *fp, int *count, const char *key, const char *name)
+{
+	if ((*count)++)
+		fputc(',', fp);
+	else
+		fprintf(fp, ",\"%s\":[", key);
+	json_fprint_escaped(fp, name);
+}
 
-	cmd = argv[argi++];
-	if (!socket_path)
-		socket_path = default_socket_path(socket_buf, sizeof(socket_buf));
+/* Writes the fields and only_populated keys for --section and --only-populated. */
+static void
+append_view(FILE *fp, const char **sections, int nsections, bool populated)
+{
+	int count = 0;
+	int i;
 
-	request_fp = open_memstream(&request, &request_sz);
-	if (!request_fp)
-		die("vwlctl: open_memstream:");
+	for (i = 0; i < nsections; i++)
+		append_name(fp, &count, "fields", sections[i]);
+	if (count)
+		fputc(']', fp);
+	if (populated)
+		fputs(",\"only_populated\":true", fp);
+}
+
+/*
+ * Writes the request for one command and its arguments to fp, under the given id.
+ * subscribe takes --field and --changes only when there is a filter to fill in.
+ * Returns NULL, or an error message that stays valid until the next call.
+ */
+static const char *
+build_request(FILE *fp, int id, const char *cmd, int argc, char *argv[], bool *binary, bool *shm,
+		struct FieldFilter *filter)
+{
+	static char error[256];
+	const char *sections[MAX_FIELDS];
+	int nsections = 0;
+	bool populated = false;
+	int argi = 0;
+
+	*binary = *shm = false;
+	if (!strcmp(cmd, "get-state") || !strcmp(cmd, "subscribe")) {
+		if (argi < argc && !strcmp(argv[argi], "--binary")) {
+			*binary = true;
+			argi++;
+			fputs("{\"id\":0,\"type\":\"hello\",\"protocol\":\"binary\"}\n", fp);
+		}
+	}
 
 	if (!strcmp(cmd, "get-state")) {
-		fputs("{\"id\":1,\"type\":\"get_state\"}", request_fp);
+		if (!*binary && argi < argc && !strcmp(argv[argi], "--shm")) {
+			*shm = true;
+			argi++;
+		}
+		while (!*shm && argi < argc) {
+			if (!strcmp(argv[argi], "--section")) {
+				if (argi + 1 >= argc)
+					return "--section requires a value";
+				if (nsections == MAX_FIELDS)
+					return "too many sections";
+				sections[nsections++] = argv[argi + 1];
+				argi += 2;
+			} else if (!strcmp(argv[argi], "--only-populated")) {
+				populated = true;
+				argi++;
+			} else {
+				goto unknown;
+			}
+		}
+		if (argi < argc)
+			goto unknown;
+		if (*binary && (nsections || populated))
+			return "--section and --only-populated need the JSON protocol";
+		fprintf(fp, "{\"id\":%d,\"type\":\"%s\"", id, *shm ? "get_state_fd" : "get_state");
+		append_view(fp, sections, nsections, populated);
+		fputc('}', fp);
+	} else if (!strcmp(cmd, "get-stats")) {
+		fprintf(fp, "{\"id\":%d,\"type\":\"get_stats\"}", id);
+	} else if (!strcmp(cmd, "metrics")) {
+		fprintf(fp, "{\"id\":%d,\"type\":\"get_metrics\"}", id);
 	} else if (!strcmp(cmd, "subscribe")) {
-		fputs("{\"id\":1,\"type\":\"subscribe\"}", request_fp);
+		const char *mode = NULL;
+		const char *since = NULL;
+		const char *max_hz = NULL;
+		int ntopics = 0;
+		int i;
+
+		fprintf(fp, "{\"id\":%d,\"type\":\"subscribe\"", id);
+		while (argi < argc) {
+			if (!strcmp(argv[argi], "--delta")) {
+				mode = "delta";
+				argi++;
+			} else if (!strcmp(argv[argi], "--since")) {
+				if (argi + 1 >= argc)
+					return "--since requires a value";
+				since = argv[argi + 1];
+				argi += 2;
+			} else if (!strcmp(argv[argi], "--max-hz")) {
+				if (argi + 1 >= argc)
+					return "--max-hz requires a value";
+				max_hz = argv[argi + 1];
+				argi += 2;
+			} else if (!strcmp(argv[argi], "--topic")) {
+				if (argi + 1 >= argc)
+					return "--topic requires a value";
+				append_name(fp, &ntopics, "topics", argv[argi + 1]);
+				argi += 2;
+			} else if (!strcmp(argv[argi], "--section")) {
+				if (argi + 1 >= argc)
+					return "--section requires a value";
+				if (nsections == MAX_FIELDS)
+					return "too many sections";
+				sections[nsections++] = argv[argi + 1];
+				argi += 2;
+			} else if (!strcmp(argv[argi], "--only-populated")) {
+				populated = true;
+				argi++;
+			} else if (filter && !strcmp(argv[argi], "--field")) {
+				if (argi + 1 >= argc)
+					return "--field requires a value";
+				if (filter->npaths == MAX_FIELDS)
+					return "too many fields";
+				filter->paths[filter->npaths++] = argv[argi + 1];
+				argi += 2;
+			} else if (filter && !strcmp(argv[argi], "--changes")) {
+				filter->changes = true;
+				argi++;
+			} else {
+				goto unknown;
+			}
+		}
+		if (filter && (filter->npaths || filter->changes) && (mode || *binary))
+			return "--field and --changes need a JSON snapshot subscription";
+		if (*binary && (nsections || populated))
+			return "--section and --only-populated need the JSON protocol";
+		if (ntopics)
+			fputc(']', fp);
+		/* without explicit sections, ask for just the ones the fields lie in */
+		for (i = 0; filter && !nsections && i < filter->npaths && field_section(filter->paths[i]); i++)
+			;
+		if (filter && !nsections && filter->npaths && i == filter->npaths) {
+			for (i = 0; i < filter->npaths; i++)
+				sections[nsections++] = field_section(filter->paths[i]);
+		}
+		append_view(fp, sections, nsections, populated);
+		if (mode)
+			fprintf(fp, ",\"mode\":\"%s\"", mode);
+		if (since)
+			fprintf(fp, ",\"since_seq\":%s", since);
+		if (max_hz)
+			fprintf(fp, ",\"max_hz\":%s", max_hz);
+		fputc('}', fp);
+	} else if (!strcmp(cmd, "watch-geometry")) {
+		fprintf(fp, "{\"id\":%d,\"type\":\"watch_geometry\"", id);
+		if (argi < argc && !strcmp(argv[argi], "--none")) {
+			if (++argi < argc)
+				goto unknown;
+			fputs(",\"clients\":[]", fp);
+		} else if (argi < argc) {
+			fputs(",\"clients\":[", fp);
+			for (; argi < argc; argi++) {
+				if (!isdigit((unsigned char)argv[argi][0]))
+					goto unknown;
+				fprintf(fp, "%s%s", argi ? "," : "", argv[argi]);
+			}
+			fputc(']', fp);
+		}
+		fputc('}', fp);
 	} else if (!strcmp(cmd, "set-workspace")) {
 		if (argi >= argc)
-			die("vwlctl: set-workspace requires WORKSPACE_ID");
-		fprintf(request_fp, "{\"id\":1,\"type\":\"set_workspace\",\"workspace_id\":%s}", argv[argi]);
+			return "set-workspace requires WORKSPACE_ID";
+		fprintf(fp, "{\"id\":%d,\"type\":\"set_workspace\",\"workspace_id\":%s}", id, argv[argi]);
+		argi++;
+	} else if (!strcmp(cmd, "focus-client") || !strcmp(cmd, "close-client")) {
+		bool focus = !strcmp(cmd, "focus-client");
+
+		if (argi >= argc)
+			return focus ? "focus-client requires CLIENT_ID" : "close-client requires CLIENT_ID";
+		fprintf(fp, "{\"id\":%d,\"type\":\"%s\",\"client_id\":%s}", id,
+				focus ? "focus_client" : "close_client", argv[argi]);
 		argi++;
+	} else if (!strcmp(cmd, "move-client-to-workspace")) {
+		if (argi >= argc)
+			return "move-client-to-workspace requires CLIENT_ID";
+		if (argi + 1 >= argc)
+			return "move-client-to-workspace requires WORKSPACE_ID";
+		fprintf(fp, "{\"id\":%d,\"type\":\"move_client_to_workspace\",\"client_id\":%s,", id, argv[argi]);
+		fprintf(fp, "\"workspace_id\":%s}", argv[argi + 1]);
+		argi += 2;
+	} else if (!strcmp(cmd, "wait-for")) {
+		static const char *const conditions[][2] = {
+				{"app", "app_mapped"},
+				{"workspace", "workspace_visible"},
+				{"output", "output_present"},
+		};
+		const char *output_name = NULL;
+		const char *vout_name = NULL;
+		const char *vout_id = NULL;
+		const char *timeout = NULL;
+		int needs_comma = 1;
+		size_t i;
+
+		if (argi >= argc)
+			return "wait-for requires app, workspace or output";
+		for (i = 0; i < sizeof(conditions) / sizeof(conditions[0]); i++) {
+			if (!strcmp(argv[argi], conditions[i][0]))
+				break;
+		}
+		if (i == sizeof(conditions) / sizeof(conditions[0]))
+			goto unknown;
+		if (argi + 1 >= argc) {
+			snprintf(error, sizeof(error), "wait-for %s requires a value", conditions[i][0]);
+			return error;
+		}
+		fprintf(fp, "{\"id\":%d,\"type\":\"wait\",\"condition\":", id);
+		json_fprint_escaped(fp, conditions[i][1]);
+		fputc(',', fp);
+		if (i == 0) {
+			fputs("\"app_id\":", fp);
+			json_fprint_escaped(fp, argv[argi + 1]);
+		} else if (i == 1) {
+			fprintf(fp, "\"workspace_id\":%s", argv[argi + 1]);
+		} else {
+			fputs("\"output\":", fp);
+			json_fprint_escaped(fp, argv[argi + 1]);
+		}
+		argi += 2;
+
+		while (argi < argc) {
+			if (!strcmp(argv[argi], "--timeout")) {
+				if (argi + 1 >= argc)
+					return "--timeout requires a value";
+				timeout = argv[argi + 1];
+				argi += 2;
+			} else if (i == 1 && !strcmp(argv[argi], "--vout-id")) {
+				if (argi + 1 >= argc)
+					return "--vout-id requires a value";
+				vout_id = argv[argi + 1];
+				argi += 2;
+			} else if (i == 1 && !strcmp(argv[argi], "--output")) {
+				if (argi + 1 >= argc)
+					return "--output requires a value";
+				output_name = argv[argi + 1];
+				argi += 2;
+			} else if (i == 1 && !strcmp(argv[argi], "--vout")) {
+				if (argi + 1 >= argc)
+					return "--vout requires a value";
+				vout_name = argv[argi + 1];
+				argi += 2;
+			} else {
+				goto unknown;
+			}
+		}
+		if (vout_id || output_name || vout_name) {
+			if (!vout_id && (!output_name || !vout_name))
+				return "virtual output requires --vout-id or --output NAME --vout NAME";
+			append_vout_ref(fp, &needs_comma, output_name, vout_name, vout_id);
+		}
+		if (timeout)
+			fprintf(fp, ",\"timeout_ms\":%s", timeout);
+		fputc('}', fp);
 	} else if (!strcmp(cmd, "spawn-on-workspace")) {
 		if (argi >= argc)
-			die("vwlctl: spawn-on-workspace requires WORKSPACE_ID");
+			return "spawn-on-workspace requires WORKSPACE_ID";
 		if (argi + 1 >= argc)
-			die("vwlctl: spawn-on-workspace requires COMMAND");
-		fprintf(request_fp, "{\"id\":1,\"type\":\"spawn_on_workspace\",\"workspace_id\":%s,\"command\":",
+			return "spawn-on-workspace requires COMMAND";
+		fprintf(fp, "{\"id\":%d,\"type\":\"spawn_on_workspace\",\"workspace_id\":%s,\"command\":", id,
 				argv[argi]);
 		argi++;
-		json_write_escaped(request_fp, argv[argi]);
-		fputc('}', request_fp);
+		json_fprint_escaped(fp, argv[argi]);
+		fputc('}', fp);
 		argi = argc;
 	} else if (!strcmp(cmd, "set-vout-focus") || !strcmp(cmd, "move-workspace-to-vout")) {
 		const char *workspace_id = NULL;
@@ -220,46 +737,831 @@ main(int argc, char *argv[])
 
 		if (!strcmp(cmd, "move-workspace-to-vout")) {
 			if (argi >= argc)
-				die("vwlctl: move-workspace-to-vout requires WORKSPACE_ID");
+				return "move-workspace-to-vout requires WORKSPACE_ID";
 			workspace_id = argv[argi++];
 		}
 
 		while (argi < argc) {
 			if (!strcmp(argv[argi], "--vout-id")) {
 				if (argi + 1 >= argc)
-					die("vwlctl: --vout-id requires a value");
+					return "--vout-id requires a value";
 				vout_id = argv[argi + 1];
 				argi += 2;
 			} else if (!strcmp(argv[argi], "--output")) {
 				if (argi + 1 >= argc)
-					die("vwlctl: --output requires a value");
+					return "--output requires a value";
 				output_name = argv[argi + 1];
 				argi += 2;
 			} else if (!strcmp(argv[argi], "--vout")) {
 				if (argi + 1 >= argc)
-					die("vwlctl: --vout requires a value");
+					return "--vout requires a value";
 				vout_name = argv[argi + 1];
 				argi += 2;
 			} else {
-				die("vwlctl: unknown argument %s", argv[argi]);
+				goto unknown;
 			}
 		}
+		if (!vout_id && (!output_name || !vout_name))
+			return "virtual output requires --vout-id or --output NAME --vout NAME";
 
-		fprintf(request_fp, "{\"id\":1,\"type\":");
-		json_write_escaped(request_fp,
-				!strcmp(cmd, "set-vout-focus") ? "set_vout_focus" : "move_workspace_to_vout");
+		fprintf(fp, "{\"id\":%d,\"type\":", id);
+		json_fprint_escaped(fp, !strcmp(cmd, "set-vout-focus") ? "set_vout_focus" : "move_workspace_to_vout");
 		needs_comma = 1;
 		if (workspace_id)
-			fprintf(request_fp, ",\"workspace_id\":%s", workspace_id);
-		append_vout_ref(request_fp, &needs_comma, output_name, vout_name, vout_id);
-		fputc('}', request_fp);
+			fprintf(fp, ",\"workspace_id\":%s", workspace_id);
+		append_vout_ref(fp, &needs_comma, output_name, vout_name, vout_id);
+		fputc('}', fp);
+	} else {
+		snprintf(error, sizeof(error), "unknown command %s", cmd);
+		return error;
+	}
+	return NULL;
+
+unknown:
+	snprintf(error, sizeof(error), "unknown argument %s", argv[argi]);
+	return error;
+}
+
+/*
+ * Finds the value at a dot-separated path of object keys and array indexes in the
+ * JSON at [p, end). Returns where it starts and sets *value_end, or returns NULL.
+ */
+static const char *
+json_find(const char *p, const char *end, const char *path, const char **value_end)
+{
+	char key[64];
+	size_t len, key_len;
+	long index;
+
+	for (p = json_skip_ws(p, end); *path; path += len + (path[len] == '.')) {
+		len = strcspn(path, ".");
+		if (p < end && *p == '{') {
+			for (p = json_skip_ws(p + 1, end);; p = json_skip_ws(p + 1, end)) {
+				if (!(p = json_read_string(p, end, key, sizeof(key), &key_len)))
+					return NULL;
+				p = json_skip_ws(p, end);
+				if (p >= end || *p != ':')
+					return NULL;
+				p = json_skip_ws(p + 1, end);
+				if (key_len == len && len < sizeof(key) && !memcmp(key, path, len))
+					break;
+				if (!(p = json_skip_value(p, end)))
+					return NULL;
+				p = json_skip_ws(p, end);
+				if (p >= end || *p != ',')
+					return NULL;
+			}
+		} else if (p < end && *p == '[' && *path >= '0' && *path <= '9') {
+			if (json_read_int(path, path + len, &index) != path + len)
+				return NULL;
+			for (p = json_skip_ws(p + 1, end); index > 0; index--) {
+				if (!(p = json_skip_value(p, end)))
+					return NULL;
+				p = json_skip_ws(p, end);
+				if (p >= end || *p != ',')
+					return NULL;
+				p = json_skip_ws(p + 1, end);
+			}
+			if (p >= end || *p == ']')
+				return NULL;
+		} else {
+			return NULL;
+		}
+	}
+	*value_end = json_skip_value(p, end);
+	return *value_end ? p : NULL;
+}
+
+/*
+ * Prints the --field values from the state in a subscribe reply or event on one
+ * line, tab-separated, with strings unquoted and missing values as null. Without
+ * fields the state itself is printed. With --changes, repeats are left out.
+ */
+static void
+print_fields(struct FieldFilter *filter, const char *line)
+{
+	const char *end = line + strlen(line);
+	const char *state, *state_end = NULL, *value, *value_end = NULL;
+	char *out = NULL, *str;
+	size_t out_len = 0, len;
+	FILE *fp;
+	int i;
+
+	fp = open_memstream(&out, &out_len);
+	if (!fp)
+		die("vwlctl: open_memstream:");
+	state = json_find(line, end, "state", &state_end);
+	if (!filter->npaths)
+		fwrite(state ? state : line, 1, (size_t)(state ? state_end - state : end - line), fp);
+	for (i = 0; i < filter->npaths; i++) {
+		if (i)
+			fputc('\t', fp);
+		value = state ? json_find(state, state_end, filter->paths[i], &value_end) : NULL;
+		if (!value) {
+			fputs("null", fp);
+		} else if (*value == '"') {
+			/* unescaping never makes a string longer */
+			str = malloc((size_t)(value_end - value));
+			if (!str)
+				die("vwlctl: malloc:");
+			json_read_string(value, value_end, str, (size_t)(value_end - value), &len);
+			fwrite(str, 1, len, fp);
+			free(str);
+		} else {
+			fwrite(value, 1, (size_t)(value_end - value), fp);
+		}
+	}
+	fclose(fp);
+
+	if (filter->changes && filter->last && filter->last_len == out_len && !memcmp(filter->last, out, out_len)) {
+		free(out);
+		return;
+	}
+	fwrite(out, 1, out_len, stdout);
+	putchar('\n');
+	free(filter->last);
+	filter->last = out;
+	filter->last_len = out_len;
+}
+
+/* Prints the text of a get_metrics reply as it is, in the Prometheus text format. */
+static void
+print_metrics(const char *line)
+{
+	const char *end = line + strlen(line);
+	const char *value, *value_end = NULL;
+	char *text;
+	size_t len;
+
+	value = json_find(line, end, "metrics", &value_end);
+	if (!value || *value != '"')
+		die("vwlctl: malformed metrics reply");
+	/* unescaping never makes a string longer */
+	text = malloc((size_t)(value_end - value));
+	if (!text)
+		die("vwlctl: malloc:");
+	if (!json_read_string(value, value_end, text, (size_t)(value_end - value), &len))
+		die("vwlctl: malformed metrics reply");
+	fwrite(text, 1, len, stdout);
+	free(text);
+}
+
+/* Splits a command line into words in place, honouring '...', "..." and backslash escapes. */
+static int
+split_words(char *line, char *words[], int max)
+{
+	char *p = line, *out;
+	char quote;
+	int n = 0;
+
+	for (;;) {
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (!*p || *p == '#')
+			return n;
+		if (n == max)
+			return -1;
+		words[n++] = out = p;
+		for (quote = 0; *p; p++) {
+			if (quote) {
+				if (*p == quote) {
+					quote = 0;
+					continue;
+				}
+				if (*p == '\\' && quote == '"' && p[1])
+					p++;
+			} else if (*p == '\'' || *p == '"') {
+				quote = *p;
+				continue;
+			} else if (*p == ' ' || *p == '\t') {
+				break;
+			} else if (*p == '\\' && p[1]) {
+				p++;
+			}
+			*out++ = *p;
+		}
+		if (quote)
+			return -1;
+		if (*p)
+			p++;
+		*out = '\0';
+	}
+}
+
+static void
+write_all(int fd, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			die("vwlctl: write:");
+		data += n;
+		len -= (size_t)n;
+	}
+}
+
+/* Reads what is available from fd into buf, keeping a byte spare; returns 0 at end of file. */
+static ssize_t
+fill_lines(int fd, char **buf, size_t *len, size_t *cap)
+{
+	ssize_t n;
+
+	if (*cap - *len < 4096) {
+		*cap = *cap ? *cap * 2 : 8192;
+		*buf = realloc(*buf, *cap);
+		if (!*buf)
+			die("vwlctl: realloc:");
+	}
+	do {
+		n = read(fd, *buf + *len, *cap - *len - 1);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		die("vwlctl: read:");
+	*len += (size_t)n;
+	return n;
+}
+
+/* Sends the request for one line of input; returns -1 if the line was rejected. */
+static int
+repl_send(int fd, char *line, int id)
+{
+	char *words[REPL_MAX_WORDS];
+	char *request = NULL;
+	size_t request_sz = 0;
+	const char *error;
+	bool binary, shm;
+	FILE *fp;
+	int n = split_words(line, words, REPL_MAX_WORDS);
+
+	if (n == 0)
+		return 0;
+	if (n < 0) {
+		fprintf(stderr, "vwlctl: unterminated quote or too many words\n");
+		return -1;
+	}
+	fp = open_memstream(&request, &request_sz);
+	if (!fp)
+		die("vwlctl: open_memstream:");
+	error = build_request(fp, id, words[0], n - 1, words + 1, &binary, &shm, NULL);
+	if (!error && (binary || shm))
+		error = "--binary and --shm need a connection of their own";
+	fputc('\n', fp);
+	fclose(fp);
+	if (!error)
+		write_all(fd, request, request_sz);
+	else
+		fprintf(stderr, "vwlctl: %s\n", error);
+	free(request);
+	return error ? -1 : 1;
+}
+
+/*
+ * Reads commands from stdin, one per line, and sends each as soon as it is read
+ * over a single connection, numbering requests from 1. Replies and subscription
+ * events are printed as they arrive; match replies to requests by their id.
+ */
+static int
+run_repl(const char *socket_path)
+{
+	struct pollfd fds[2];
+	char *in = NULL, *out = NULL;
+	size_t in_len = 0, in_cap = 0, out_len = 0, out_cap = 0;
+	char *line, *nl;
+	int fd = connect_socket(socket_path);
+	int id = 1, pending = 0, status = 0;
+	int nfds;
+	bool in_eof = false, shut = false;
+
+	fds[0] = (struct pollfd){.fd = fd, .events = POLLIN};
+	fds[1] = (struct pollfd){.fd = STDIN_FILENO, .events = POLLIN};
+	for (;;) {
+		/* in stays NULL until stdin is first read */
+		for (line = in; in_len && pending < REPL_MAX_PENDING &&
+				(nl = memchr(line, '\n', in_len - (size_t)(line - in)));
+				line = nl + 1) {
+			*nl = '\0';
+			switch (repl_send(fd, line, id)) {
+			case 1:
+				id++;
+				pending++;
+				break;
+			case -1:
+				status = 1;
+				break;
+			}
+		}
+		if (in_len) {
+			in_len -= (size_t)(line - in);
+			memmove(in, line, in_len);
+		}
+		/* the compositor closes the connection once every reply is out */
+		if (in_eof && !in_len && !shut) {
+			shutdown(fd, SHUT_WR);
+			shut = true;
+		}
+
+		nfds = in_eof || pending >= REPL_MAX_PENDING ? 1 : 2;
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("vwlctl: poll:");
+		}
+
+		if (fds[0].revents) {
+			if (!fill_lines(fd, &out, &out_len, &out_cap))
+				break;
+			for (line = out; (nl = memchr(line, '\n', out_len - (size_t)(line - out))); line = nl + 1) {
+				*nl = '\0';
+				puts(line);
+				if (!strncmp(line, "{\"id\":", 6)) {
+					pending--;
+					if (json_reply_ok(line) != 1)
+						status = 1;
+				}
+			}
+			out_len -= (size_t)(line - out);
+			memmove(out, line, out_len);
+			fflush(stdout);
+		}
+
+		if (nfds == 2 && fds[1].revents) {
+			in_eof = !fill_lines(STDIN_FILENO, &in, &in_len, &in_cap);
+			/* a last line without a newline still counts */
+			if (in_eof && in_len && in[in_len - 1] != '\n')
+				in[in_len++] = '\n';
+		}
+	}
+	if (out_len || !shut)
+		die("vwlctl: connection closed by compositor");
+	free(in);
+	free(out);
+	close(fd);
+	return status;
+}
+
+/* One connection opened by vwlctl bench. */
+struct BenchConn {
+	int fd;
+	enum { BENCH_CLIENT, BENCH_SUBSCRIBER, BENCH_STALLED } role;
+	bool subscribed; /* the reply to subscribe has arrived */
+	bool dropped; /* closed by the compositor */
+	char *buf;
+	size_t len, cap;
+	uint64_t *sent; /* send times of the requests still awaiting a reply, oldest at sent_head */
+	size_t sent_head, sent_len, sent_cap;
+	size_t next_set; /* first set_workspace this subscriber has not seen applied */
+};
+
+struct BenchSamples {
+	uint64_t *v; /* nanoseconds */
+	size_t len, cap;
+};
+
+struct BenchSet {
+	long workspace;
+	uint64_t sent;
+};
+
+struct Bench {
+	struct BenchConn *conns;
+	int nconns;
+	struct BenchSet *sets; /* every set_workspace sent, in order */
+	size_t nsets, sets_cap;
+	struct BenchSamples rtt, fanout;
+	unsigned long sent, replied, failed, events;
+};
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static unsigned long
+bench_number(const char *opt, const char *value)
+{
+	char *end;
+	unsigned long n;
+
+	if (!value)
+		die("vwlctl: %s requires a value", opt);
+	errno = 0;
+	n = strtoul(value, &end, 10);
+	if (errno || end == value || *end || *value == '-')
+		die("vwlctl: invalid %s %s", opt, value);
+	return n;
+}
+
+static void
+bench_sample(struct BenchSamples *s, uint64_t v)
+{
+	if (s->len == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 1024;
+		s->v = realloc(s->v, s->cap * sizeof(*s->v));
+		if (!s->v)
+			die("vwlctl: realloc:");
+	}
+	s->v[s->len++] = v;
+}
+
+static int
+bench_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Prints the nearest-rank percentiles of the samples in microseconds. */
+static void
+bench_print_latency(const char *name, struct BenchSamples *s)
+{
+	static const double q[] = {0.5, 0.9, 0.99};
+	size_t i, rank;
+
+	printf("%-12s", name);
+	if (!s->len) {
+		puts(" no samples");
+		return;
+	}
+	qsort(s->v, s->len, sizeof(*s->v), bench_cmp);
+	for (i = 0; i < sizeof(q) / sizeof(q[0]); i++) {
+		rank = (size_t)(q[i] * (double)s->len + 0.999999);
+		printf(" p%g %.1fus", q[i] * 100, (double)s->v[rank ? rank - 1 : 0] / 1000.0);
+	}
+	printf(" max %.1fus\n", (double)s->v[s->len - 1] / 1000.0);
+}
+
+/* Writes a whole request; returns -1 once the compositor has closed the connection. */
+static int
+bench_send(struct BenchConn *c, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = send(c->fd, data, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EPIPE || errno == ECONNRESET)) {
+			c->dropped = true;
+			return -1;
+		}
+		if (n < 0)
+			die("vwlctl: send:");
+		data += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+/*
+ * Credits an event to the newest set_workspace this subscriber has not seen that
+ * targets the focused workspace it reports; state changes made in one compositor
+ * iteration arrive as one event, so the older ones are taken as seen too.
+ */
+static void
+bench_event(struct Bench *b, struct BenchConn *c, const char *line, uint64_t now)
+{
+	const char *end = line + strlen(line);
+	const char *value, *value_end;
+	long workspace;
+	size_t i;
+
+	b->events++;
+	if (!(value = json_find(line, end, "state.focused_workspace", &value_end)) &&
+			!(value = json_find(line, end, "focused_workspace", &value_end)))
+		return;
+	if (json_read_int(value, value_end, &workspace) != value_end)
+		return;
+	for (i = b->nsets; i > c->next_set; i--) {
+		if (b->sets[i - 1].workspace == workspace) {
+			bench_sample(&b->fanout, now - b->sets[i - 1].sent);
+			c->next_set = i;
+			return;
+		}
+	}
+}
+
+static void
+bench_read(struct Bench *b, struct BenchConn *c)
+{
+	char *line, *nl;
+	uint64_t now;
+	ssize_t n;
+
+	if (c->cap - c->len < 4096) {
+		c->cap = c->cap ? c->cap * 2 : 8192;
+		c->buf = realloc(c->buf, c->cap);
+		if (!c->buf)
+			die("vwlctl: realloc:");
+	}
+	do {
+		n = read(c->fd, c->buf + c->len, c->cap - c->len);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0) {
+		if (n < 0 && errno != ECONNRESET)
+			die("vwlctl: read:");
+		c->dropped = true;
+		return;
+	}
+	now = now_ns();
+	c->len += (size_t)n;
+
+	for (line = c->buf; (nl = memchr(line, '\n', c->len - (size_t)(line - c->buf))); line = nl + 1) {
+		*nl = '\0';
+		if (strncmp(line, "{\"id\":", 6)) {
+			if (c->role == BENCH_SUBSCRIBER)
+				bench_event(b, c, line, now);
+		} else if (c->role == BENCH_SUBSCRIBER && !c->subscribed) {
+			if (json_reply_ok(line) != 1)
+				die("vwlctl: subscribe failed: %s", line);
+			c->subscribed = true;
+			c->next_set = b->nsets;
+		} else if (c->sent_len) {
+			bench_sample(&b->rtt, now - c->sent[c->sent_head++]);
+			c->sent_len--;
+			b->replied++;
+			if (json_reply_ok(line) != 1)
+				b->failed++;
+		}
+	}
+	c->len -= (size_t)(line - c->buf);
+	memmove(c->buf, line, c->len);
+}
+
+/* Waits up to timeout_ms for any connection and handles what it has; returns how many were ready. */
+static int
+bench_poll(struct Bench *b, struct pollfd *fds, int timeout_ms)
+{
+	int i, n;
+
+	for (i = 0; i < b->nconns; i++) {
+		fds[i].fd = b->conns[i].dropped ? -1 : b->conns[i].fd;
+		/* stalled subscribers never read, but still see the compositor hang up */
+		fds[i].events = b->conns[i].role == BENCH_STALLED ? 0 : POLLIN;
+		fds[i].revents = 0;
+	}
+	n = poll(fds, (nfds_t)b->nconns, timeout_ms);
+	if (n < 0 && errno != EINTR)
+		die("vwlctl: poll:");
+	for (i = 0; i < b->nconns && n > 0; i++) {
+		if (!fds[i].revents)
+			continue;
+		if (b->conns[i].role == BENCH_STALLED)
+			b->conns[i].dropped = true;
+		else
+			bench_read(b, &b->conns[i]);
+	}
+	return n;
+}
+
+/* Sends the next request of the load on the next request connection still open. */
+static void
+bench_request(struct Bench *b, int nclients, unsigned long set_every, unsigned long workspaces)
+{
+	struct BenchConn *c = NULL;
+	char line[128];
+	bool set;
+	int i, len;
+
+	for (i = 0; i < nclients; i++) {
+		c = &b->conns[(b->sent + (unsigned long)i) % (unsigned long)nclients];
+		if (!c->dropped)
+			break;
+	}
+	if (i == nclients)
+		return;
+
+	set = set_every && b->sent % set_every == set_every - 1;
+	if (set) {
+		if (b->nsets == b->sets_cap) {
+			b->sets_cap = b->sets_cap ? b->sets_cap * 2 : 256;
+			b->sets = realloc(b->sets, b->sets_cap * sizeof(*b->sets));
+			if (!b->sets)
+				die("vwlctl: realloc:");
+		}
+		b->sets[b->nsets].workspace = (long)(1 + b->nsets % workspaces);
+		len = snprintf(line, sizeof(line), "{\"id\":%lu,\"type\":\"set_workspace\",\"workspace_id\":%ld}\n",
+				b->sent + 1, b->sets[b->nsets].workspace);
 	} else {
+		len = snprintf(line, sizeof(line), "{\"id\":%lu,\"type\":\"get_state\"}\n", b->sent + 1);
+	}
+
+	if (c->sent_len == c->sent_cap - c->sent_head) {
+		memmove(c->sent, c->sent + c->sent_head, c->sent_len * sizeof(*c->sent));
+		c->sent_head = 0;
+		if (c->sent_len == c->sent_cap) {
+			c->sent_cap = c->sent_cap ? c->sent_cap * 2 : 64;
+			c->sent = realloc(c->sent, c->sent_cap * sizeof(*c->sent));
+			if (!c->sent)
+				die("vwlctl: realloc:");
+		}
+	}
+	c->sent[c->sent_head + c->sent_len] = now_ns();
+	if (bench_send(c, line, (size_t)len) < 0)
+		return;
+	if (set)
+		b->sets[b->nsets++].sent = c->sent[c->sent_head + c->sent_len];
+	c->sent_len++;
+	b->sent++;
+}
+
+/*
+ * Opens the subscriber and request connections, waits for every subscription to
+ * be answered, then sends get_state and set_workspace requests round-robin over
+ * the request connections at a fixed rate and reports how long replies and the
+ * resulting events took to arrive.
+ */
+static int
+run_bench(const char *socket_path, int argc, char *argv[])
+{
+	struct Bench b = {0};
+	struct pollfd *fds;
+	char *sub_argv[2 * MAX_FIELDS + 1];
+	char *request = NULL;
+	size_t request_sz = 0;
+	unsigned long subscribers = 8, stalled = 0, clients = 4, rate = 200, duration = 5;
+	unsigned long set_every = 4, workspaces = 2;
+	unsigned long dropped[3] = {0};
+	const char *error;
+	uint64_t start, now, next, end, interval;
+	int sub_argc = 0, argi, i;
+	bool binary, shm, waiting;
+	FILE *fp;
+
+	for (argi = 0; argi < argc; argi++) {
+		const char *opt = argv[argi], *value = argi + 1 < argc ? argv[argi + 1] : NULL;
+
+		if (!strcmp(opt, "--delta")) {
+			sub_argv[sub_argc++] = argv[argi];
+			continue;
+		}
+		if (!strcmp(opt, "--topic")) {
+			if (!value)
+				die("vwlctl: --topic requires a value");
+			if (sub_argc + 2 > (int)(sizeof(sub_argv) / sizeof(sub_argv[0])))
+				die("vwlctl: too many topics");
+			sub_argv[sub_argc++] = argv[argi];
+			sub_argv[sub_argc++] = argv[++argi];
+			continue;
+		}
+		if (!strcmp(opt, "--subscribers"))
+			subscribers = bench_number(opt, value);
+		else if (!strcmp(opt, "--stalled"))
+			stalled = bench_number(opt, value);
+		else if (!strcmp(opt, "--clients"))
+			clients = bench_number(opt, value);
+		else if (!strcmp(opt, "--rate"))
+			rate = bench_number(opt, value);
+		else if (!strcmp(opt, "--duration"))
+			duration = bench_number(opt, value);
+		else if (!strcmp(opt, "--set-every"))
+			set_every = bench_number(opt, value);
+		else if (!strcmp(opt, "--workspaces"))
+			workspaces = bench_number(opt, value);
+		else
+			die("vwlctl: unknown argument %s", opt);
+		argi++;
+	}
+	if (!clients || !rate || !duration)
+		die("vwlctl: --clients, --rate and --duration must be positive");
+	if (!workspaces || workspaces >= VWL_IPC_SHM_WORKSPACES)
+		die("vwlctl: invalid --workspaces %lu", workspaces);
+	if (subscribers + stalled + clients > 4096)
+		die("vwlctl: too many connections");
+
+	fp = open_memstream(&request, &request_sz);
+	if (!fp)
+		die("vwlctl: open_memstream:");
+	if ((error = build_request(fp, 1, "subscribe", sub_argc, sub_argv, &binary, &shm, NULL)))
+		die("vwlctl: %s", error);
+	fputc('\n', fp);
+	fclose(fp);
+
+	/* request connections come first, so bench_request() can index them */
+	b.nconns = (int)(clients + subscribers + stalled);
+	b.conns = ecalloc((size_t)b.nconns, sizeof(*b.conns));
+	fds = ecalloc((size_t)b.nconns, sizeof(*fds));
+	for (i = 0; i < b.nconns; i++) {
+		struct BenchConn *c = &b.conns[i];
+
+		c->fd = connect_socket(socket_path);
+		if ((unsigned long)i < clients)
+			continue;
+		c->role = (unsigned long)i < clients + subscribers ? BENCH_SUBSCRIBER : BENCH_STALLED;
+		if (bench_send(c, request, request_sz) < 0)
+			die("vwlctl: connection closed by compositor");
+	}
+	free(request);
+
+	end = now_ns() + 10 * 1000000000ull;
+	do {
+		for (waiting = false, i = 0; i < b.nconns; i++) {
+			if (b.conns[i].dropped && b.conns[i].role != BENCH_STALLED)
+				die("vwlctl: connection closed by compositor");
+			waiting |= b.conns[i].role == BENCH_SUBSCRIBER && !b.conns[i].subscribed;
+		}
+		if (waiting && now_ns() >= end)
+			die("vwlctl: timed out waiting for subscriptions");
+	} while (waiting && bench_poll(&b, fds, 100) >= 0);
+
+	interval = 1000000000ull / rate;
+	start = next = now_ns();
+	end = start + duration * 1000000000ull;
+	while ((now = now_ns()) < end) {
+		for (; next <= now; next += interval)
+			bench_request(&b, (int)clients, set_every, workspaces);
+		bench_poll(&b, fds, (int)((next - now + 999999) / 1000000));
+	}
+
+	/* collect the outstanding replies, then the events that follow them */
+	end = now + 2 * 1000000000ull;
+	do {
+		for (waiting = false, i = 0; i < (int)clients; i++)
+			waiting |= b.conns[i].sent_len && !b.conns[i].dropped;
+	} while (now_ns() < end && (bench_poll(&b, fds, 100) > 0 || waiting));
+
+	for (i = 0; i < b.nconns; i++) {
+		dropped[b.conns[i].role] += b.conns[i].dropped;
+		close(b.conns[i].fd);
+		free(b.conns[i].buf);
+		free(b.conns[i].sent);
+	}
+	printf("requests     %lu sent, %lu replied, %lu failed, %.1f/s\n", b.sent, b.replied, b.failed,
+			(double)b.sent * 1e9 / (double)(now - start));
+	bench_print_latency("round-trip", &b.rtt);
+	printf("events       %lu to %lu subscribers, %zu workspace switches\n", b.events, subscribers, b.nsets);
+	bench_print_latency("fan-out", &b.fanout);
+	printf("dropped      %lu/%lu subscribers, %lu/%lu stalled, %lu/%lu clients\n", dropped[BENCH_SUBSCRIBER],
+			subscribers, dropped[BENCH_STALLED], stalled, dropped[BENCH_CLIENT], clients);
+
+	free(b.conns);
+	free(b.sets);
+	free(b.rtt.v);
+	free(b.fanout.v);
+	free(fds);
+	return b.failed || b.replied < b.sent ? 1 : 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	char socket_buf[PATH_MAX];
+	const char *socket_path = NULL;
+	const char *cmd;
+	FILE *request_fp;
+	FILE *reply_fp;
+	char *request = NULL;
+	size_t request_sz = 0;
+	char *reply;
+	const char *error;
+	struct FieldFilter filter = {0};
+	int fd;
+	int argi = 1;
+	int status;
+	bool binary, shm;
+
+	while (argi < argc && !strcmp(argv[argi], "--socket")) {
+		if (argi + 1 >= argc) {
+			usage(stderr);
+			return 1;
+		}
+		socket_path = argv[argi + 1];
+		argi += 2;
+	}
+
+	if (argi >= argc) {
 		usage(stderr);
-		fclose(request_fp);
-		free(request);
 		return 1;
 	}
 
+	cmd = argv[argi++];
+	if (!socket_path && !(socket_path = vwl_ipc_socket_path(socket_buf, sizeof(socket_buf)))) {
+		if (errno == ENAMETOOLONG)
+			die("vwlctl: socket path too long");
+		die("vwlctl: XDG_RUNTIME_DIR must be set or VWL_SOCKET provided");
+	}
+
+	if (!strcmp(cmd, "bench"))
+		return run_bench(socket_path, argc - argi, argv + argi);
+	if (!strcmp(cmd, "repl") || !strcmp(cmd, "--stdin")) {
+		if (argi < argc)
+			die("vwlctl: unknown argument %s", argv[argi]);
+		return run_repl(socket_path);
+	}
+
+	request_fp = open_memstream(&request, &request_sz);
+	if (!request_fp)
+		die("vwlctl: open_memstream:");
+	if ((error = build_request(request_fp, 1, cmd, argc - argi, argv + argi, &binary, &shm, &filter)))
+		die("vwlctl: %s", error);
 	fclose(request_fp);
 
 	fd = connect_socket(socket_path);
@@ -267,16 +1569,41 @@ main(int argc, char *argv[])
 		die("vwlctl: write:");
 	free(request);
 
+	if (shm) {
+		status = run_shm(fd);
+		close(fd);
+		return status;
+	}
+
 	reply_fp = fdopen(fd, "r+");
 	if (!reply_fp)
 		die("vwlctl: fdopen:");
 
-	if (!strcmp(cmd, "subscribe")) {
+	if (binary) {
+		status = run_binary(reply_fp, !strcmp(cmd, "subscribe"));
+		fclose(reply_fp);
+		return status;
+	}
+
+	if (!strcmp(cmd, "subscribe") || !strcmp(cmd, "watch-geometry")) {
+		status = 1;
 		while ((reply = read_line(reply_fp))) {
-			puts(reply);
+			/* a rejected subscription gets no events */
+			if (status == 1 && json_reply_ok(reply) == 0) {
+				puts(reply);
+				free(reply);
+				fclose(reply_fp);
+				return 1;
+			}
+			if (filter.npaths || filter.changes)
+				print_fields(&filter, reply);
+			else
+				puts(reply);
 			fflush(stdout);
+			status = 0;
 			free(reply);
 		}
+		free(filter.last);
 		fclose(reply_fp);
 		return 0;
 	}
@@ -284,8 +1611,11 @@ main(int argc, char *argv[])
 	reply = read_line(reply_fp);
 	if (!reply)
 		die("vwlctl: no reply from compositor");
-	puts(reply);
 	status = json_reply_ok(reply);
+	if (status == 1 && !strcmp(cmd, "metrics"))
+		print_metrics(reply);
+	else
+		puts(reply);
 	free(reply);
 	fclose(reply_fp);
 	return status == 1 ? 0 : 1;